@@ -39,6 +39,7 @@
 #include <stdexcept>
 #include <cstdio>
 #include <cstdlib>              // for getenv()
+#include <streambuf>            // for GnuplotPipeBuf
 #include <list>                 // for std::list
 
 
@@ -65,6 +66,38 @@ public:
 
 
 
+///\brief streambuf writing straight into the gnuplot pipe, so that data
+/// (e.g. an inline datablock) can be sent without a temporary file
+class GnuplotPipeBuf : public std::streambuf
+{
+public:
+    GnuplotPipeBuf(FILE **pipe) : pipe(pipe) {}
+
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        if (*pipe && c != traits_type::eof())
+            fputc(c, *pipe);
+        return traits_type::not_eof(c);
+    }
+
+    virtual std::streamsize xsputn(const char *s, std::streamsize n)
+    {
+        if (!*pipe)
+            return n;  // no session: discard, like cmd() does
+        return fwrite(s, 1, n, *pipe);
+    }
+
+    virtual int sync()
+    {
+        return (*pipe && fflush(*pipe) != 0) ? -1 : 0;
+    }
+
+private:
+    FILE **pipe;
+};
+
+
 class Gnuplot
 {
 private:
@@ -85,6 +118,9 @@ private:
     std::string              smooth;
     ///\brief list of created tmpfiles
     std::vector<std::string> tmpfile_list;
+    ///\brief stream into the pipe, for inline data
+    GnuplotPipeBuf           pipebuf{&gnucmd};
+    std::ostream             pipestream{&pipebuf};
 
     //----------------------------------------------------------------------------------
     // static data
@@ -223,6 +259,18 @@ public:
         return(*this);
     }
 
+    // -------------------------------------------------------------------------
+    ///\brief Stream writing raw data into the pipe, e.g. the lines of a
+    /// datablock between "$name << EOD" and "EOD"; flush it before the
+    /// next cmd()
+    ///
+    /// \return <-- the stream
+    // -------------------------------------------------------------------------
+    inline std::ostream& data()
+    {
+        return pipestream;
+    }
+
 
 
     //--------------------------------------------------------------------------
@@ -1029,8 +1077,6 @@ void stringtok (Container &container,
 //
 Gnuplot::~Gnuplot()
 {
-//  remove_tmpfiles();
-
     // A stream opened by popen() should be closed by pclose()
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
     if (_pclose(gnucmd) == -1)
@@ -1038,6 +1084,16 @@ Gnuplot::~Gnuplot()
     if (pclose(gnucmd) == -1)
 #endif
         std::cerr << "Gnuplot::~Gnuplot: Problem closing communication to gnuplot" << std::endl;
+
+    // only now that gnuplot has exited is it done reading them
+    try
+    {
+        remove_tmpfiles();
+    }
+    catch (GnuplotException &e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
 }
 
 
@@ -2050,6 +2106,7 @@ void Gnuplot::remove_tmpfiles()
         }
 
         Gnuplot::tmpfile_num -= static_cast<int>(tmpfile_list.size());
+        tmpfile_list.clear();
     }
 }
 #endif
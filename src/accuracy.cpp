@@ -0,0 +1,465 @@
+/* fieldviz_accuracy: compares computed fields against closed-form
+ * references at several discretizations, timing each, and fails if
+ * the error or the time per point exceeds the budget stored for it.
+ * Times are budgeted in units of one kernel evaluation, measured in
+ * the same run, so that budgets carry over between machines.  It also
+ * checks every vector kernel this CPU supports against the scalar
+ * one.
+ *
+ *   fieldviz_accuracy [--record] [--min-time S] [BUDGET_FILE]
+ *
+ * --record rewrites BUDGET_FILE from this run, with some headroom. */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+#include "scene.h"
+
+#include <fml/fml.h>
+
+using namespace fieldviz;
+using namespace fml;
+using namespace std;
+
+#ifndef BUDGET_FILE
+#define BUDGET_FILE "accuracy.budgets"
+#endif
+
+/* headroom given to recorded budgets: errors are deterministic but
+ * differ in the last digits between compilers, times are noisy */
+const scalar ERROR_MARGIN = 2, ERROR_FLOOR = 1e-12;
+const scalar TIME_MARGIN = 3;
+
+const int EXIT_REGRESSED = 1, EXIT_USAGE = 2;
+
+double min_time = .1;
+
+/* a source with a known field at one point */
+struct Case {
+    const char *name;
+    FieldType type;
+    const char *spec;
+    vec3 x;
+    vec3 (*reference)(vec3 x);
+    /* compare magnitudes only, where the direction depends on how the
+     * winding is traversed */
+    bool magnitude;
+};
+
+/* how the sources are discretized */
+struct Mode {
+    const char *name;
+    Quadrature quad;
+    scalar delta;
+};
+
+/* infinite wire along z, approximated by one 2000 long: |B| = u0 I /
+ * (2 pi rho), about the z axis */
+vec3 infinite_wire(vec3 x)
+{
+    scalar rho = sqrt(x[0] * x[0] + x[1] * x[1]);
+    return vec3(-x[1], x[0], 0) * (U0 / (2 * M_PI * rho * rho));
+}
+
+/* segment from z = -1 to 1: B = u0 I / (4 pi rho) (sin a2 - sin a1) */
+vec3 finite_wire(vec3 x)
+{
+    scalar rho = sqrt(x[0] * x[0] + x[1] * x[1]);
+    scalar z1 = -1 - x[2], z2 = 1 - x[2];
+    scalar f = z2 / sqrt(rho * rho + z2 * z2) - z1 / sqrt(rho * rho + z1 * z1);
+    return vec3(-x[1], x[0], 0) * (K_M * f / (rho * rho));
+}
+
+/* unit loop about z, on its axis: Bz = u0 I R^2 / 2 (R^2 + z^2)^3/2 */
+vec3 loop_axis(vec3 x)
+{
+    return vec3(0, 0, U0 / (2 * pow(1 + x[2] * x[2], 1.5)));
+}
+
+/* solenoid of radius a, length L and n turns per unit length, at its
+ * center: Bz = u0 n I L / sqrt(L^2 + 4 a^2) */
+const scalar SOL_RADIUS = .5, SOL_LENGTH = 10, SOL_PITCH = .05;
+
+vec3 solenoid_center(vec3)
+{
+    scalar L = SOL_LENGTH, a = SOL_RADIUS;
+    return vec3(0, 0, U0 / SOL_PITCH * L / sqrt(L * L + 4 * a * a));
+}
+
+/* toroid with N turns, inside its tube: |B| = u0 N I / (2 pi r) */
+const scalar TOR_TURNS = 100;
+
+vec3 toroid_inside(vec3 x)
+{
+    return vec3(U0 * TOR_TURNS / (2 * M_PI * x.magnitude()), 0, 0);
+}
+
+/* unit sphere with unit surface charge, outside: E = Q / 4 pi e0 r^2 */
+vec3 sphere_outside(vec3 x)
+{
+    scalar r = x.magnitude();
+    return x * (K_E * 4 * M_PI / (r * r * r));
+}
+
+/* unit disk about z with unit surface charge, on its axis:
+ * Ez = sigma / 2 e0 (1 - z / sqrt(z^2 + R^2)) */
+vec3 disk_axis(vec3 x)
+{
+    scalar z = x[2];
+    return vec3(0, 0, 2 * M_PI * K_E * (1 - z / sqrt(z * z + 1)));
+}
+
+const Case cases[] = {
+    { "wire/infinite", FieldType::B, "line 0 0 -1000 0 0 1000", vec3(.6, .8, .3), infinite_wire, false },
+    { "wire/finite", FieldType::B, "line 0 0 -1 0 0 1", vec3(.3, .4, .3), finite_wire, false },
+    { "loop/axis", FieldType::B, "arc 0 0 0 1 0 0 0 0 1 6.283185307179586", vec3(0, 0, .5), loop_axis, false },
+    { "solenoid/center", FieldType::B, "solenoid 0 0 -5 .5 0 0 0 0 1 1256.6370614359173 .05", vec3(0, 0, 0), solenoid_center, false },
+    /* the pitch the README flags */
+    { "toroid/pitch", FieldType::B, "toroid 0 0 0 2 0 0 0 0 1 .5 6.283185307179586 .06283185307179587", vec3(2, 0, 0), toroid_inside, true },
+    { "sphere/outside", FieldType::E, "sphere 0 0 0 1", vec3(1.2, -.9, 1.1), sphere_outside, false },
+    { "disk/axis", FieldType::E, "disk 0 0 0 1 0 0 0 0 1 6.283185307179586", vec3(0, 0, .5), disk_axis, false },
+};
+
+const Mode modes[] = {
+    { "uniform-0.1", QUAD_UNIFORM, .1 },
+    { "uniform-0.05", QUAD_UNIFORM, .05 },
+    { "uniform-0.02", QUAD_UNIFORM, .02 },
+    { "gauss4-0.1", QUAD_GAUSS, .1 },
+};
+
+/* an error of NO_BUDGET (`-' in the file) is not checked */
+const scalar NO_BUDGET = -1;
+
+struct Budget {
+    scalar error, cost;
+};
+
+struct Result {
+    string name;
+    size_t samples;
+    scalar error, ns;
+
+    /* ns per point over ns per kernel evaluation */
+    scalar cost;
+};
+
+/* ns per kernel evaluation on this machine */
+double eval_ns;
+
+bool load_budgets(const string &path, map<string, Budget> &budgets)
+{
+    ifstream in(path);
+    if(!in)
+        return false;
+
+    string line;
+    while(getline(in, line))
+    {
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        stringstream ss(line);
+        string name, error;
+        Budget b;
+        if(ss >> name >> error >> b.cost)
+        {
+            b.error = (error == "-") ? NO_BUDGET : atof(error.c_str());
+            budgets[name] = b;
+        }
+        else
+            cerr << path << ": bad line: " << line << endl;
+    }
+
+    return true;
+}
+
+bool save_budgets(const string &path, const vector<Result> &results)
+{
+    ofstream out(path);
+    if(!out)
+        return false;
+
+    out << "# fieldviz_accuracy budgets: configuration, maximum relative error" << endl;
+    out << "# (- for none), maximum time per point in kernel evaluations." << endl;
+    out << "# Regenerate with fieldviz_accuracy --record." << endl;
+    out << setprecision(3);
+
+    for(const Result &r : results)
+        out << r.name << " " << max(r.error * ERROR_MARGIN, ERROR_FLOOR) << " " << r.cost * TIME_MARGIN << endl;
+
+    return (bool)out;
+}
+
+/* the case's source, discretized as the mode says; returns its ID */
+int add_case(Scene &scene, const Case &c, const Mode &m)
+{
+    scene.set_analytic(false);
+    scene.set_delta(m.delta);
+    scene.set_quadrature(m.quad);
+
+    stringstream ss(c.spec);
+    Shape shape;
+    shared_ptr<Manifold> path = parse_curve(ss, shape);
+    return (c.type == FieldType::B) ? scene.add_current(1, path, shape) : scene.add_charge(1, path, shape);
+}
+
+Result measure(const Case &c, const Mode &m)
+{
+    Scene scene;
+    int id = add_case(scene, c, m);
+
+    Result r;
+    r.name = string(c.name) + "/" + m.name;
+    r.samples = scene.entities().at(id).samples.size();
+
+    vec3 f = scene.field(c.type, c.x), ref = c.reference(c.x);
+    if(c.magnitude)
+        r.error = fabs(f.magnitude() - ref.magnitude()) / ref.magnitude();
+    else
+        r.error = (f - ref).magnitude() / ref.magnitude();
+
+    typedef chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    double elapsed;
+    int runs = 0;
+    do {
+        f += scene.field(c.type, c.x);
+        runs++;
+        elapsed = chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < min_time);
+    r.ns = elapsed * 1e9 / runs;
+    r.cost = r.ns / eval_ns;
+
+    return r;
+}
+
+/* the time of one kernel evaluation with the selected kernels, from a
+ * long solenoid's samples seen from a few points */
+double measure_eval_ns()
+{
+    Scene scene;
+    const SampleSet &s = scene.entities().at(add_case(scene, cases[3], modes[1])).samples;
+    const vec3 pts[] = { vec3(0, 0, 0), vec3(.3, .1, 2), vec3(1, 1, -4), vec3(-2, .5, 1) };
+
+    typedef chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    double elapsed;
+    vec3 sink = 0;
+    size_t evals = 0;
+    do {
+        for(vec3 x : pts)
+            sink += biot_savart(s, x);
+        evals += s.size() * 4;
+        elapsed = chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < min_time);
+
+    /* keep the work from being optimized away */
+    if(sink[0] == 12345)
+        cerr << sink << endl;
+
+    return elapsed * 1e9 / evals;
+}
+
+/* sum of the magnitudes of the terms a kernel adds up, which scales
+ * the difference allowed between kernels */
+struct TermMagnitudes {
+    FieldType type;
+    vec3 point;
+    scalar sum = 0;
+
+    TermMagnitudes(FieldType type, vec3 point) : type(type), point(point) {}
+
+    void operator()(vec3 s, vec3 ds, scalar w)
+    {
+        vec3 r = point - s;
+        scalar r2 = r.magnitudeSquared();
+
+        if(type == FieldType::B)
+            sum += ds.cross(r).magnitude() / (r2 * sqrt(r2));
+        else
+            sum += w / r2;
+    }
+};
+
+vec3 kernel(FieldType type, const SampleSet &s, vec3 x)
+{
+    return (type == FieldType::B) ? biot_savart(s, x) : coulomb(s, x);
+}
+
+/* Compare each vector kernel the CPU supports with the scalar one over
+ * every case's samples, at the case's point and a few around it, within
+ * KERNEL_TOLERANCE of the summed term magnitudes.  Returns the number of
+ * kernels out of tolerance. */
+int check_kernels()
+{
+    const KernelISA isas[] = { ISA_AVX2, ISA_AVX512 };
+    const vec3 offsets[] = { vec3(0, 0, 0), vec3(.3, -.2, .1), vec3(-1.1, .4, .7), vec3(2, 2, -2) };
+    int failed = 0;
+
+    cout << endl << left << setw(12) << "kernel" << right
+         << setw(14) << "worst error" << setw(14) << "tolerance" << "  status" << endl;
+
+    for(KernelISA isa : isas)
+    {
+        cout << left << setw(12) << kernel_isa_name(isa) << right;
+
+        if(set_kernel_isa(isa) != isa)
+        {
+            cout << setw(14) << "-" << setw(14) << "-" << "  not supported, skipped" << endl;
+            continue;
+        }
+
+        /* the largest error as a fraction of what is allowed */
+        scalar worst = 0;
+
+        for(const Case &c : cases)
+            for(const Mode &m : modes)
+            {
+                Scene scene;
+                const SampleSet &s = scene.entities().at(add_case(scene, c, m)).samples;
+
+                for(vec3 d : offsets)
+                {
+                    vec3 x = c.x + d;
+
+                    set_kernel_isa(ISA_SCALAR);
+                    vec3 ref = kernel(c.type, s, x);
+                    set_kernel_isa(isa);
+                    vec3 f = kernel(c.type, s, x);
+
+                    TermMagnitudes mag(c.type, x);
+                    s.for_each(mag);
+
+                    worst = max(worst, (f - ref).magnitude() / (KERNEL_TOLERANCE * mag.sum));
+                }
+            }
+
+        cout << setprecision(3) << setw(14) << worst * KERNEL_TOLERANCE << setw(14) << KERNEL_TOLERANCE;
+        if(worst > 1)
+        {
+            cout << "  DISAGREES WITH SCALAR" << endl;
+            failed++;
+        }
+        else
+            cout << "  ok" << endl;
+    }
+
+    set_kernel_isa(ISA_AUTO);
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    string budget_file = BUDGET_FILE;
+    bool record = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--record")
+            record = true;
+        else if(arg == "--min-time" && i + 1 < argc)
+            min_time = atof(argv[++i]);
+        else if(arg[0] != '-')
+            budget_file = arg;
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--record] [--min-time SECONDS] [BUDGET_FILE]" << endl;
+            return EXIT_USAGE;
+        }
+    }
+
+    map<string, Budget> budgets;
+    if(!record && !load_budgets(budget_file, budgets))
+    {
+        cerr << "cannot read " << budget_file << " (record one with --record)" << endl;
+        return EXIT_USAGE;
+    }
+
+    vector<Result> results;
+    int failed = 0;
+
+    eval_ns = measure_eval_ns();
+    cout << "one " << kernel_isa_name(kernel_isa()) << " kernel evaluation: "
+         << setprecision(3) << eval_ns << " ns; costs are per point, in evaluations" << endl << endl;
+
+    cout << left << setw(32) << "configuration" << right
+         << setw(9) << "samples" << setw(12) << "error" << setw(12) << "budget"
+         << setw(12) << "ns/point" << setw(12) << "cost" << setw(12) << "budget" << "  status" << endl;
+
+    for(const Case &c : cases)
+        for(const Mode &m : modes)
+        {
+            Result r = measure(c, m);
+            results.push_back(r);
+
+            cout << left << setw(32) << r.name << right << setprecision(3)
+                 << setw(9) << r.samples << setw(12) << r.error;
+
+            const char *status = "recorded";
+            if(!record)
+            {
+                map<string, Budget>::iterator it = budgets.find(r.name);
+                if(it == budgets.end())
+                {
+                    cout << setw(12) << "-" << setw(12) << r.ns << setw(12) << r.cost << setw(12) << "-";
+                    status = "no budget";
+                }
+                else
+                {
+                    const Budget &b = it->second;
+                    bool error_over = b.error != NO_BUDGET && r.error > b.error;
+
+                    if(b.error == NO_BUDGET)
+                        cout << setw(12) << "-";
+                    else
+                        cout << setw(12) << b.error;
+                    cout << setw(12) << r.ns << setw(12) << r.cost << setw(12) << b.cost;
+
+                    status = "ok";
+                    if(error_over)
+                        status = "ERROR REGRESSED";
+                    else if(r.cost > b.cost)
+                        status = "TIME REGRESSED";
+                    if(error_over || r.cost > b.cost)
+                        failed++;
+                }
+            }
+            else
+                cout << setw(12) << "-" << setw(12) << r.ns << setw(12) << r.cost << setw(12) << "-";
+
+            cout << "  " << status << endl;
+        }
+
+    int kernels_failed = check_kernels();
+
+    if(record)
+    {
+        if(!save_budgets(budget_file, results))
+        {
+            cerr << "cannot write " << budget_file << endl;
+            return EXIT_USAGE;
+        }
+        cout << "Wrote " << budget_file << endl;
+    }
+    else if(failed)
+        cout << failed << " of " << results.size() << " configurations over budget" << endl;
+    else
+        cout << "all " << results.size() << " configurations within budget" << endl;
+
+    if(kernels_failed)
+        cout << kernels_failed << " vector kernel(s) out of tolerance" << endl;
+
+    return (failed || kernels_failed) ? EXIT_REGRESSED : 0;
+}
@@ -0,0 +1,155 @@
+#include "analytic.h"
+
+#include <cmath>
+
+using namespace fml;
+
+namespace fieldviz {
+
+/* arcs this close to 2 pi are treated as full loops */
+static const scalar FULL_TURN_TOLERANCE = 1e-3;
+
+/* below this b / a the loop integrals switch to their series */
+static const scalar LOOP_SERIES_CUTOFF = 1e-3;
+
+static bool is_full_loop(const Shape &s)
+{
+    return s.kind == Shape::ARC && std::fabs(s.angle - 2 * M_PI) < FULL_TURN_TOLERANCE;
+}
+
+bool has_analytic(const Shape &s)
+{
+    return s.kind == Shape::LINE || is_full_loop(s);
+}
+
+void ellint_KE(scalar m, scalar &K, scalar &E)
+{
+    /* arithmetic-geometric mean: K = pi / (2 AGM(1, sqrt(1 - m))),
+     * E = K (1 - sum 2^(n-1) c_n^2) */
+    scalar a = 1, b = std::sqrt(1 - m), c = std::sqrt(m);
+    scalar weight = .5, sum = weight * c * c;
+
+    for(int i = 0; i < 32 && std::fabs(c) > 1e-17 * a; i++)
+    {
+        scalar an = (a + b) / 2;
+        c = (a - b) / 2;
+        b = std::sqrt(a * b);
+        a = an;
+
+        weight *= 2;
+        sum += weight * c * c;
+    }
+
+    K = M_PI / (2 * a);
+    E = K * (1 - sum);
+}
+
+/* Straight segment a -> b.  With t the unit direction, z1 and z2 the
+ * coordinates of x along t relative to a and b, and rho the offset of x
+ * from the line,
+ *
+ *   biot_savart = t x rho f
+ *   coulomb     = rho f + t (1/|r2| - 1/|r1|)
+ *
+ * where f = (z1/|r1| - z2/|r2|) / |rho|^2. */
+static void segment(const Shape &s, vec3 x, vec3 &t, vec3 &rho, scalar &f, scalar &n1, scalar &n2)
+{
+    vec3 d = s.b - s.a;
+    scalar len = d.magnitude();
+    t = d / len;
+
+    vec3 r1 = x - s.a, r2 = x - s.b;
+    scalar z1 = t.dot(r1), z2 = z1 - len;
+
+    rho = r1 - t * z1;
+    n1 = r1.magnitude();
+    n2 = r2.magnitude();
+
+    if(z1 * z2 > 0)
+    {
+        /* beyond either end both terms are close to +-1; use the
+         * rearrangement that cancels |rho|^2 analytically */
+        f = (z1 * z1 - z2 * z2) / (n1 * n2 * (z1 * n2 + z2 * n1));
+    }
+    else
+        f = (z1 / n1 - z2 / n2) / rho.magnitudeSquared();
+}
+
+/* Full loop of radius R about the normal.  With rho and z the
+ * cylindrical coordinates of x, a = rho^2 + R^2 + z^2 and b = 2 rho R,
+ * everything reduces to
+ *
+ *   I3   = int dphi / (a - b cos phi)^(3/2)       = 4 E(m) / ((a - b) sqrt(a + b))
+ *   I1   = int dphi / (a - b cos phi)^(1/2)       = 4 K(m) / sqrt(a + b)
+ *   Icos = int cos phi dphi / (a - b cos phi)^(3/2) = (a I3 - I1) / b
+ *
+ * over one turn, with m = 2b / (a + b). */
+static void loop(const Shape &s, vec3 x, vec3 &n, vec3 &rhat, scalar &R, scalar &rho, scalar &z,
+                 scalar &I3, scalar &Icos)
+{
+    n = s.normal.normalize();
+    R = s.radius.magnitude();
+
+    vec3 rel = x - s.center;
+    z = n.dot(rel);
+
+    vec3 rv = rel - n * z;
+    rho = rv.magnitude();
+    rhat = (rho > 0) ? rv / rho : vec3(0);
+
+    scalar a = rho * rho + R * R + z * z, b = 2 * rho * R;
+
+    scalar K, E;
+    ellint_KE(2 * b / (a + b), K, E);
+
+    I3 = 4 * E / ((a - b) * std::sqrt(a + b));
+
+    scalar ratio = b / a;
+    if(ratio < LOOP_SERIES_CUTOFF)
+    {
+        /* (a I3 - I1) cancels near the axis; expand in b / a instead */
+        Icos = M_PI / (a * std::sqrt(a)) * (1.5 * ratio + 105.0 / 64 * ratio * ratio * ratio);
+    }
+    else
+        Icos = (a * I3 - 4 * K / std::sqrt(a + b)) / b;
+}
+
+vec3 analytic_biot_savart(const Shape &s, vec3 x)
+{
+    if(s.kind == Shape::LINE)
+    {
+        vec3 t, rho;
+        scalar f, n1, n2;
+        segment(s, x, t, rho, f, n1, n2);
+
+        return t.cross(rho) * (f * s.sense);
+    }
+
+    /* dl x r = R (z cos phi, z sin phi, R - rho cos phi) dphi */
+    vec3 n, rhat;
+    scalar R, rho, z, I3, Icos;
+    loop(s, x, n, rhat, R, rho, z, I3, Icos);
+
+    return (rhat * (R * z * Icos) + n * (R * (R * I3 - rho * Icos))) * s.sense;
+}
+
+vec3 analytic_coulomb(const Shape &s, vec3 x)
+{
+    if(s.kind == Shape::LINE)
+    {
+        vec3 t, rho;
+        scalar f, n1, n2;
+        segment(s, x, t, rho, f, n1, n2);
+
+        return rho * f + t * (1 / n2 - 1 / n1);
+    }
+
+    /* |dl| r = R (rho - R cos phi, -R sin phi, z) dphi */
+    vec3 n, rhat;
+    scalar R, rho, z, I3, Icos;
+    loop(s, x, n, rhat, R, rho, z, I3, Icos);
+
+    return rhat * (R * (rho * I3 - R * Icos)) + n * (R * z * I3);
+}
+
+} /* namespace fieldviz */
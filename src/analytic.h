@@ -0,0 +1,33 @@
+#ifndef FIELDVIZ_ANALYTIC_H
+#define FIELDVIZ_ANALYTIC_H
+
+#include <fml/fml.h>
+
+#include "shape.h"
+
+namespace fieldviz {
+
+/* Closed forms of the integrals that biot_savart() and coulomb()
+ * approximate by sampling, in the same units (before physical
+ * constants and source strength):
+ *
+ *   biot_savart: integral of ds x r / |r|^3
+ *   coulomb:     integral of |ds| r / |r|^3,   r = x - s
+ *
+ * Straight segments are elementary; full circular loops reduce to
+ * complete elliptic integrals.  Exact up to rounding, at one
+ * evaluation per source. */
+
+/* true if the shape has a closed form here */
+bool has_analytic(const Shape &shape);
+
+fml::vec3 analytic_biot_savart(const Shape &shape, fml::vec3 x);
+fml::vec3 analytic_coulomb(const Shape &shape, fml::vec3 x);
+
+/* complete elliptic integrals of the first and second kind, K(m) and
+ * E(m), with parameter m = k^2 */
+void ellint_KE(fml::scalar m, fml::scalar &K, fml::scalar &E);
+
+} /* namespace fieldviz */
+
+#endif
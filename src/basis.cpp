@@ -0,0 +1,96 @@
+#include "basis.h"
+
+using namespace fml;
+
+namespace fieldviz {
+
+void axpy(scalar a, const std::vector<vec3> &x, std::vector<vec3> &y)
+{
+    size_t n = y.size();
+    for(size_t i = 0; i < n; i++)
+        y[i] += x[i] * a;
+}
+
+std::vector<int> BasisField::ids() const
+{
+    std::vector<int> v;
+    for(auto &p : parts)
+        v.push_back(p.first);
+    return v;
+}
+
+void BasisField::add(int id, scalar weight, std::vector<vec3> &&basis)
+{
+    /* IDs only grow, so a new source normally comes last in the sum, and
+     * adding it in gives exactly what a fresh sum in ID order would */
+    bool last = parts.empty() || parts.rbegin()->first < id;
+
+    Part &p = parts[id];
+    p.weight = weight;
+    p.basis = std::move(basis);
+
+    if(last)
+        axpy(weight, p.basis, total);
+    else
+        resum();
+}
+
+void BasisField::set_weight(int id, scalar weight)
+{
+    Part &p = parts.at(id);
+    if(p.weight == weight)
+        return;
+
+    p.weight = weight;
+    resum();
+}
+
+void BasisField::set_weights(const std::map<int, scalar> &weights)
+{
+    bool changed = false;
+
+    for(auto i = parts.begin(); i != parts.end(); )
+    {
+        auto w = weights.find(i->first);
+        if(w == weights.end())
+        {
+            i = parts.erase(i);
+            changed = true;
+            continue;
+        }
+
+        if(i->second.weight != w->second)
+        {
+            i->second.weight = w->second;
+            changed = true;
+        }
+        i++;
+    }
+
+    if(changed)
+        resum();
+}
+
+/* Subtracting the part from the total would leave rounding noise where
+ * the remaining sources cancel, which the plot's normalization turns
+ * into arbitrary directions; re-summing what is left costs one axpy
+ * per remaining source and matches a fresh evaluation exactly. */
+bool BasisField::remove(int id)
+{
+    if(!parts.erase(id))
+        return false;
+
+    resum();
+    return true;
+}
+
+void BasisField::resum()
+{
+    for(vec3 &v : total)
+        v = 0;
+
+    for(auto &p : parts)
+        axpy(p.second.weight, p.second.basis, total);
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,62 @@
+#ifndef FIELDVIZ_BASIS_H
+#define FIELDVIZ_BASIS_H
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#include <fml/fml.h>
+
+namespace fieldviz {
+
+/* y += a * x */
+void axpy(fml::scalar a, const std::vector<fml::vec3> &x, std::vector<fml::vec3> &y);
+
+/* Fields are linear in each source's strength (current or charge
+ * density), so a field over a fixed set of points can be kept as one
+ * unit-strength basis field per source, keyed by entity ID, plus
+ * weights.  Adding a source evaluates only its basis; changing a
+ * strength or dropping a source is a weighted re-sum, with no
+ * integration at all. */
+class BasisField {
+public:
+    /* sum of weight * basis over the sources, in ID order */
+    std::vector<fml::vec3> total;
+
+    explicit BasisField(size_t points = 0) : total(points) {}
+
+    size_t points() const { return total.size(); }
+
+    /* memory held by the total and the basis fields */
+    size_t bytes() const { return (parts.size() + 1) * points() * sizeof(fml::vec3); }
+
+    bool has(int id) const { return parts.count(id) != 0; }
+    fml::scalar weight(int id) const { return parts.at(id).weight; }
+
+    /* source IDs present, ascending */
+    std::vector<int> ids() const;
+
+    void add(int id, fml::scalar weight, std::vector<fml::vec3> &&basis);
+    void set_weight(int id, fml::scalar weight);
+
+    /* keeps only the sources in weights, with those weights, re-summing
+     * once however many change; weights for absent IDs are ignored */
+    void set_weights(const std::map<int, fml::scalar> &weights);
+
+    /* returns whether id was present */
+    bool remove(int id);
+
+private:
+    struct Part {
+        fml::scalar weight;
+        std::vector<fml::vec3> basis;
+    };
+
+    std::map<int, Part> parts;
+
+    void resum();
+};
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,325 @@
+/* fieldviz_bench: times the field kernels per manifold type, whole
+ * field grids, and output formatting, and prints the results as JSON
+ * so that runs can be compared between releases. */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hwcounters.h"
+#include "kernels.h"
+#include "scene.h"
+#include "writer.h"
+
+#include <fml/fml.h>
+
+using namespace fieldviz;
+using namespace fml;
+using namespace std;
+
+/* one measurement; rates that do not apply are left at 0 */
+struct Result {
+    string name;
+    size_t points = 0, samples = 0, bytes = 0;
+    double seconds = 0; /* per run */
+    int runs = 0;
+
+    /* CPU counters over all runs, where available */
+    bool has_hw = false;
+    HwCounts hw;
+};
+
+vector<Result> results;
+
+double min_time = .5;
+
+/* whether CPU counters can be read, and if not why */
+bool hw_ok;
+string hw_why;
+
+/* run f repeatedly for at least min_time; returns seconds per run */
+template<typename F>
+double time_runs(F f, int &runs)
+{
+    typedef chrono::steady_clock clock;
+
+    clock::time_point start = clock::now();
+    double elapsed = 0;
+    runs = 0;
+
+    do {
+        f();
+        runs++;
+        elapsed = chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < min_time);
+
+    return elapsed / runs;
+}
+
+/* discards what is written, counting the bytes */
+class CountingBuf : public streambuf {
+public:
+    size_t bytes = 0;
+
+protected:
+    int_type overflow(int_type c)
+    {
+        bytes++;
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char *, streamsize n)
+    {
+        bytes += n;
+        return n;
+    }
+};
+
+/* fixed pseudo-random points in the cube [-r, r]^3 */
+vector<vec3> probe_points(size_t n, scalar r)
+{
+    vector<vec3> pts(n);
+    unsigned long long s = 88172645463325252ULL;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        vec3 p;
+        for(int k = 0; k < 3; k++)
+        {
+            s ^= s << 13;
+            s ^= s >> 7;
+            s ^= s << 17;
+            p[k] = ((s >> 11) * (1.0 / 9007199254740992.0) * 2 - 1) * r;
+        }
+        pts[i] = p;
+    }
+
+    return pts;
+}
+
+int add(Scene &scene, FieldType type, const string &spec)
+{
+    stringstream ss(spec);
+    Shape shape;
+    shared_ptr<Manifold> path = parse_curve(ss, shape);
+
+    return (type == FieldType::B) ? scene.add_current(1, path, shape) : scene.add_charge(1, path, shape);
+}
+
+/* per-point cost of one source on a single thread, integrated from its
+ * samples (closed forms off) */
+void bench_manifold(const char *name, FieldType type, const string &spec, size_t n_points)
+{
+    Scene scene;
+    scene.set_analytic(false);
+    int id = add(scene, type, spec);
+
+    vector<vec3> pts = probe_points(n_points, 3);
+    vec3 sink = 0;
+
+    Result r;
+    r.name = string("field/") + (type == FieldType::B ? "B/" : "E/") + name;
+    r.points = pts.size();
+    r.samples = scene.entities().at(id).samples.size();
+
+    HwCounts before, after;
+    bool hw = hw_ok && hw_read(before);
+
+    r.seconds = time_runs([&] {
+            for(vec3 x : pts)
+                sink += scene.field(type, x);
+        }, r.runs);
+
+    if(hw && hw_read(after))
+    {
+        r.has_hw = true;
+        r.hw = after - before;
+    }
+
+    /* keep the work from being optimized away */
+    if(sink[0] == 12345)
+        cerr << sink << endl;
+
+    results.push_back(r);
+}
+
+/* a `field' grid of side^3 points, evaluated on every thread and
+ * formatted as text as fieldviz plots it; closed forms are off, so
+ * every solver works from the samples that are counted */
+void bench_grid(Solver solver, size_t side, ThreadPool &pool)
+{
+    Scene scene;
+    scene.set_solver(solver);
+    scene.set_analytic(false);
+    add(scene, FieldType::B, "line 0 0 -1 0 0 1");
+    add(scene, FieldType::B, "solenoid 0 0 -1 1 0 0 0 0 1 62.83 .2");
+
+    vector<vec3> pts;
+    scalar step = 2.0 / (side - 1);
+    for(size_t k = 0; k < side; k++)
+        for(size_t j = 0; j < side; j++)
+            for(size_t i = 0; i < side; i++)
+                pts.push_back(vec3(-1 + i * step, -1 + j * step, -1 + k * step));
+
+    const char *names[] = { "direct", "tree", "fmm" };
+
+    Result r;
+    r.name = "grid/B/" + string(names[solver]) + "/" + to_string(side) + "^3";
+    r.points = pts.size();
+    for(auto &e : scene.entities())
+        r.samples += e.second.samples.size();
+
+    r.seconds = time_runs([&] {
+            vector<vec3> field;
+            scene.field(FieldType::B, pts, field, pool);
+
+            CountingBuf buf;
+            ostream out(&buf);
+            TextWriter w(out);
+            for(size_t i = 0; i < pts.size(); i++)
+                w.line(pts[i], field[i].normalize() / 10);
+            w.flush();
+
+            r.bytes = buf.bytes;
+        }, r.runs);
+
+    results.push_back(r);
+}
+
+/* formatting alone, for n point/vector records */
+template<typename W, typename... Args>
+void bench_writer(const char *name, size_t n, Args... args)
+{
+    vector<vec3> pts = probe_points(n, 10);
+
+    Result r;
+    r.name = string("write/") + name;
+    r.points = n;
+    r.seconds = time_runs([&] {
+            CountingBuf buf;
+            ostream out(&buf);
+            {
+                W w(out, args...);
+                for(size_t i = 0; i < n; i++)
+                    w.line(pts[i], pts[n - 1 - i]);
+            }
+            r.bytes = buf.bytes;
+        }, r.runs);
+
+    results.push_back(r);
+}
+
+void print_json(unsigned threads)
+{
+    cout << "{" << endl;
+    cout << "  \"threads\": " << threads << "," << endl;
+    cout << "  \"kernel\": \"" << kernel_isa_name(kernel_isa()) << "\"," << endl;
+    cout << "  \"min_time\": " << min_time << "," << endl;
+    cout << "  \"cpu_counters\": " << (hw_ok ? "true" : "false") << "," << endl;
+    if(!hw_ok)
+        cout << "  \"cpu_counters_unavailable\": \"" << hw_why << "\"," << endl;
+    cout << "  \"results\": [" << endl;
+
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+
+        cout << "    { \"name\": \"" << r.name << "\""
+             << ", \"runs\": " << r.runs
+             << ", \"seconds\": " << r.seconds;
+
+        if(r.points)
+            cout << ", \"points\": " << r.points
+                 << ", \"ns_per_point\": " << r.seconds * 1e9 / r.points;
+        if(r.samples)
+            cout << ", \"samples\": " << r.samples
+                 << ", \"samples_per_s\": " << r.samples * r.points / r.seconds;
+        if(r.bytes)
+            cout << ", \"bytes\": " << r.bytes
+                 << ", \"bytes_per_s\": " << r.bytes / r.seconds;
+        if(r.has_hw)
+        {
+            /* per kernel evaluation (one sample seen from one point) */
+            double evals = (double)r.samples * r.points * r.runs;
+            const uint64_t *v = r.hw.v;
+
+            cout << ", \"ipc\": " << (v[HW_CYCLES] ? (double)v[HW_INSTRUCTIONS] / v[HW_CYCLES] : 0)
+                 << ", \"cycles_per_eval\": " << v[HW_CYCLES] / evals
+                 << ", \"cache_misses_per_eval\": " << v[HW_CACHE_MISSES] / evals
+                 << ", \"branch_misses_per_eval\": " << v[HW_BRANCH_MISSES] / evals;
+        }
+
+        cout << " }" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+
+    cout << "  ]" << endl;
+    cout << "}" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned threads = 0;
+    bool quick = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--threads" && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(arg == "--min-time" && i + 1 < argc)
+            min_time = atof(argv[++i]);
+        else if(arg == "--quick")
+            quick = true;
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--threads N] [--min-time SECONDS] [--quick]" << endl;
+            return 2;
+        }
+    }
+
+    if(quick)
+        min_time = min(min_time, .05);
+
+    hw_ok = hw_available(hw_why);
+
+    if(!threads)
+        threads = thread::hardware_concurrency();
+    ThreadPool pool(threads);
+
+    size_t n_points = quick ? 100 : 1000;
+
+    bench_manifold("line", FieldType::B, "line 0 0 -1 0 0 1", n_points);
+    bench_manifold("arc", FieldType::B, "arc 0 0 0 1 0 0 0 0 1 3.14159", n_points);
+    bench_manifold("solenoid", FieldType::B, "solenoid 0 0 -1 1 0 0 0 0 1 62.83 .2", n_points);
+    bench_manifold("toroid", FieldType::B, "toroid 0 0 0 2 0 0 0 0 1 .5 6.28319 .2", n_points);
+    bench_manifold("plane", FieldType::E, "plane -1 -1 0 2 0 0 0 2 0", n_points);
+    bench_manifold("disk", FieldType::E, "disk 0 0 0 1 0 0 0 0 1 6.28319", n_points);
+    bench_manifold("sphere", FieldType::E, "sphere 0 0 0 1", n_points);
+    bench_manifold("opencylinder", FieldType::E, "opencylinder 0 0 -1 0 0 2 1", n_points);
+    bench_manifold("closedcylinder", FieldType::E, "closedcylinder 0 0 -1 0 0 2 1", n_points);
+
+    vector<size_t> sides = { 11, 21 };
+    if(!quick)
+        sides.push_back(41);
+
+    for(size_t side : sides)
+        bench_grid(SOLVER_DIRECT, side, pool);
+    bench_grid(SOLVER_TREE, sides.back(), pool);
+    bench_grid(SOLVER_FMM, sides.back(), pool);
+
+    size_t records = quick ? 100000 : 1000000;
+    bench_writer<TextWriter>("text", records);
+    bench_writer<BinaryWriter>("float32", records, FLOAT32);
+    bench_writer<BinaryWriter>("float64", records, FLOAT64);
+
+    print_json(threads);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "fieldline.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace fml;
+
+namespace fieldviz {
+
+/* Dormand-Prince 5(4) tableau */
+static const scalar A21 = 1.0 / 5;
+static const scalar A31 = 3.0 / 40, A32 = 9.0 / 40;
+static const scalar A41 = 44.0 / 45, A42 = -56.0 / 15, A43 = 32.0 / 9;
+static const scalar A51 = 19372.0 / 6561, A52 = -25360.0 / 2187, A53 = 64448.0 / 6561, A54 = -212.0 / 729;
+static const scalar A61 = 9017.0 / 3168, A62 = -355.0 / 33, A63 = 46732.0 / 5247, A64 = 49.0 / 176, A65 = -5103.0 / 18656;
+static const scalar B1 = 35.0 / 384, B3 = 500.0 / 1113, B4 = 125.0 / 192, B5 = -2187.0 / 6784, B6 = 11.0 / 84;
+
+/* fifth minus fourth order weights, for the error estimate */
+static const scalar E1 = 71.0 / 57600, E3 = -71.0 / 16695, E4 = 71.0 / 1920,
+    E5 = -17253.0 / 339200, E6 = 22.0 / 525, E7 = -1.0 / 40;
+
+static bool inside(const TraceOptions &o, vec3 x)
+{
+    for(int k = 0; k < 3; k++)
+        if(x[k] < o.lower[k] || x[k] > o.upper[k])
+            return false;
+    return true;
+}
+
+/* distance from p to the segment a-b */
+static scalar segment_distance(vec3 p, vec3 a, vec3 b)
+{
+    vec3 ab = b - a;
+    scalar len2 = ab.magnitudeSquared();
+    scalar t = len2 > 0 ? std::max((scalar)0, std::min((scalar)1, (p - a).dot(ab) / len2)) : 0;
+    return (p - (a + ab * t)).magnitude();
+}
+
+TraceEnd trace_fieldline(const std::function<vec3(vec3)> &field,
+                         vec3 seed, scalar dir,
+                         const TraceOptions &opts,
+                         std::vector<vec3> &points)
+{
+    /* unit tangent, or 0 where the field vanishes */
+    auto tangent = [&](vec3 x) {
+        vec3 f = field(x);
+        scalar m = f.magnitude();
+        return (m > 0 && std::isfinite(m)) ? f * (dir / m) : vec3(0);
+    };
+
+    scalar diag = (opts.upper - opts.lower).magnitude();
+    scalar h = std::min(opts.max_step, opts.max_length);
+    scalar h_min = diag * 1e-12;
+
+    vec3 x = seed;
+    vec3 k1 = tangent(x);
+    scalar length = 0;
+    bool left_seed = false;
+
+    points.push_back(x);
+
+    if(!inside(opts, x))
+        return TRACE_EXITED;
+
+    size_t steps = 0, rejects = 0;
+    while(steps < opts.max_steps)
+    {
+        if(k1.magnitudeSquared() == 0)
+            return TRACE_STALLED;
+
+        if(length >= opts.max_length)
+            return TRACE_LENGTH;
+
+        if(opts.progress && opts.progress->cancelled())
+            return TRACE_CANCELLED;
+
+        h = std::min(h, std::min(opts.max_step, opts.max_length - length));
+
+        vec3 k2 = tangent(x + k1 * (h * A21));
+        vec3 k3 = tangent(x + (k1 * A31 + k2 * A32) * h);
+        vec3 k4 = tangent(x + (k1 * A41 + k2 * A42 + k3 * A43) * h);
+        vec3 k5 = tangent(x + (k1 * A51 + k2 * A52 + k3 * A53 + k4 * A54) * h);
+        vec3 k6 = tangent(x + (k1 * A61 + k2 * A62 + k3 * A63 + k4 * A64 + k5 * A65) * h);
+
+        vec3 next = x + (k1 * B1 + k3 * B3 + k4 * B4 + k5 * B5 + k6 * B6) * h;
+        vec3 k7 = tangent(next);
+
+        scalar err = ((k1 * E1 + k3 * E3 + k4 * E4 + k5 * E5 + k6 * E6 + k7 * E7) * h).magnitude();
+
+        /* standard controller, growth limited to [0.2, 5] per step */
+        scalar factor = err > 0 ? .9 * std::pow(opts.tol / err, .2) : 5;
+        factor = std::max((scalar).2, std::min((scalar)5, factor));
+
+        if(err > opts.tol)
+        {
+            h *= factor;
+            if(h < h_min || ++rejects >= opts.max_rejects)
+                return TRACE_STALLED;
+            continue;
+        }
+
+        /* Crossing a point charge or a wire flips the direction; the
+         * line ends there rather than oscillating about it. */
+        if(k7.dot(k1) < 0)
+            return TRACE_STALLED;
+
+        /* accepted (first same as last: k7 is the next k1) */
+        vec3 prev = x;
+        x = next;
+        k1 = k7;
+        length += h;
+        h *= factor;
+        steps++;
+
+        points.push_back(x);
+
+        if(!inside(opts, x))
+            return TRACE_EXITED;
+
+        if(!left_seed)
+            left_seed = (x - seed).magnitude() > 2 * opts.close_dist;
+        else if(segment_distance(seed, prev, x) < opts.close_dist)
+        {
+            points.push_back(seed);
+            return TRACE_CLOSED;
+        }
+    }
+
+    return TRACE_LENGTH;
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,64 @@
+#ifndef FIELDVIZ_FIELDLINE_H
+#define FIELDVIZ_FIELDLINE_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <fml/fml.h>
+
+#include "progress.h"
+
+namespace fieldviz {
+
+/* Field lines are integral curves of the field direction,
+ *
+ *   dx/ds = F(x) / |F(x)|,
+ *
+ * parametrized by arc length, so that step sizes mean distance no
+ * matter how strong the field is.  They are integrated with the
+ * Dormand-Prince 5(4) pair and per-step error control. */
+
+struct TraceOptions {
+    /* region to stay within */
+    fml::vec3 lower, upper;
+
+    /* allowed local error per step, in length units */
+    fml::scalar tol;
+
+    /* longest step to take, which sets how smooth the line plots */
+    fml::scalar max_step;
+
+    /* give up after this much arc length or this many accepted steps */
+    fml::scalar max_length;
+    size_t max_steps;
+
+    /* stall after this many rejected steps in all */
+    size_t max_rejects;
+
+    /* a line that comes back this close to its seed is closed */
+    fml::scalar close_dist;
+
+    /* checked every step; tracing stops once it is cancelled */
+    const Progress *progress = NULL;
+};
+
+enum TraceEnd {
+    TRACE_LENGTH,   /* ran out of length or steps */
+    TRACE_EXITED,   /* left the region */
+    TRACE_CLOSED,   /* came back to its seed */
+    TRACE_STALLED,  /* reached a zero, source or sink of the field, or
+                     * kept rejecting steps */
+    TRACE_CANCELLED,
+};
+
+/* Trace from seed in the direction of the field (dir = 1) or against it
+ * (dir = -1), appending points, seed first. */
+TraceEnd trace_fieldline(const std::function<fml::vec3(fml::vec3)> &field,
+                         fml::vec3 seed, fml::scalar dir,
+                         const TraceOptions &opts,
+                         std::vector<fml::vec3> &points);
+
+} /* namespace fieldviz */
+
+#endif
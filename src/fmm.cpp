@@ -0,0 +1,541 @@
+#include "fmm.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "trace.h"
+
+using namespace fml;
+using std::vector;
+
+namespace fieldviz {
+
+/* points per leaf cell */
+static const size_t LEAF_SIZE = 32;
+
+/* stop splitting coincident points */
+static const int MAX_DEPTH = 32;
+
+/* cells are well separated when (r_target + r_source) < FMM_THETA * distance */
+static const scalar FMM_THETA = .5;
+
+namespace {
+
+/* Multi-indices (i, j, k) of total degree <= n, ordered by degree, so
+ * that the first terms(m) of them are exactly those of degree <= m. */
+struct MultiIndex {
+    int n;
+    vector<int> i, j, k;
+    vector<int> at;
+
+    explicit MultiIndex(int n) : n(n), at((n + 1) * (n + 1) * (n + 1), -1)
+    {
+        for(int deg = 0; deg <= n; deg++)
+            for(int a = deg; a >= 0; a--)
+                for(int b = deg - a; b >= 0; b--)
+                {
+                    int c = deg - a - b;
+                    at[(a * (n + 1) + b) * (n + 1) + c] = i.size();
+                    i.push_back(a);
+                    j.push_back(b);
+                    k.push_back(c);
+                }
+    }
+
+    static int terms(int deg) { return (deg + 1) * (deg + 2) * (deg + 3) / 6; }
+
+    int index(int a, int b, int c) const { return at[(a * (n + 1) + b) * (n + 1) + c]; }
+
+    /* out[t] = d^t for the first terms(deg) indices */
+    void powers(vec3 d, int deg, scalar *out) const
+    {
+        scalar px[64], py[64], pz[64];
+        px[0] = py[0] = pz[0] = 1;
+        for(int e = 1; e <= deg; e++)
+        {
+            px[e] = px[e - 1] * d[0];
+            py[e] = py[e - 1] * d[1];
+            pz[e] = pz[e - 1] * d[2];
+        }
+
+        for(int t = 0; t < terms(deg); t++)
+            out[t] = px[i[t]] * py[j[t]] * pz[k[t]];
+    }
+};
+
+/* everything about an expansion order that doesn't depend on geometry */
+struct Tables {
+    int p;
+    MultiIndex mi;
+    vector<vector<scalar>> binom;
+
+    /* M2L: for each local term, (source term, a-term, coefficient) */
+    struct Pair { int alpha, gamma; scalar coef; };
+    vector<vector<Pair>> m2l;
+
+    /* for the derivative recurrence: t - e_d and t - 2 e_d, or -1 */
+    vector<int> down1, down2;
+
+    explicit Tables(int p) : p(p), mi(2 * p), binom(2 * p + 1, vector<scalar>(2 * p + 1, 0))
+    {
+        for(int t = 0; t < MultiIndex::terms(2 * p); t++)
+            for(int d = 0; d < 3; d++)
+            {
+                int c[3] = { mi.i[t], mi.j[t], mi.k[t] };
+                c[d] -= 1;
+                down1.push_back(c[d] >= 0 ? mi.index(c[0], c[1], c[2]) : -1);
+                c[d] -= 1;
+                down2.push_back(c[d] >= 0 ? mi.index(c[0], c[1], c[2]) : -1);
+            }
+
+        for(int a = 0; a <= 2 * p; a++)
+        {
+            binom[a][0] = 1;
+            for(int b = 1; b <= a; b++)
+                binom[a][b] = binom[a - 1][b - 1] + (b <= a - 1 ? binom[a - 1][b] : 0);
+        }
+
+        int nt = MultiIndex::terms(p);
+        m2l.resize(nt);
+        for(int beta = 0; beta < nt; beta++)
+            for(int alpha = 0; alpha < nt; alpha++)
+            {
+                int gi = mi.i[alpha] + mi.i[beta];
+                int gj = mi.j[alpha] + mi.j[beta];
+                int gk = mi.k[alpha] + mi.k[beta];
+
+                scalar coef = binom[gi][mi.i[alpha]] * binom[gj][mi.j[alpha]] * binom[gk][mi.k[alpha]];
+                if((mi.i[alpha] + mi.j[alpha] + mi.k[alpha]) & 1)
+                    coef = -coef;
+
+                m2l[beta].push_back({ alpha, mi.index(gi, gj, gk), coef });
+            }
+    }
+
+    int terms() const { return MultiIndex::terms(p); }
+
+    /* a[t] = D^t (1/|R|) / t! up to degree 2p, by the recurrence
+     * n |R|^2 a_t = -(2n - 1) sum R_k a_{t - e_k} - (n - 1) sum a_{t - 2 e_k} */
+    void derivatives(vec3 R, scalar *a) const
+    {
+        scalar r2 = R.magnitudeSquared();
+        a[0] = 1 / std::sqrt(r2);
+
+        for(int t = 1; t < MultiIndex::terms(2 * p); t++)
+        {
+            int n = mi.i[t] + mi.j[t] + mi.k[t];
+            scalar s1 = 0, s2 = 0;
+
+            for(int d = 0; d < 3; d++)
+            {
+                if(down1[3 * t + d] >= 0)
+                    s1 += R[d] * a[down1[3 * t + d]];
+                if(down2[3 * t + d] >= 0)
+                    s2 += a[down2[3 * t + d]];
+            }
+
+            a[t] = -((2 * n - 1) * s1 + (n - 1) * s2) / (n * r2);
+        }
+    }
+};
+
+void build_cells(const vector<vec3> &pts, vector<size_t> &order,
+                 vector<FMM::Cell> &cells,
+                 vec3 center, scalar width, size_t begin, size_t end, int depth)
+{
+    int idx = cells.size();
+    cells.push_back(FMM::Cell());
+
+    FMM::Cell c;
+    c.center = center;
+    c.width = width;
+    c.begin = begin;
+    c.end = end;
+    c.leaf = (end - begin <= LEAF_SIZE || depth >= MAX_DEPTH);
+
+    c.radius = 0;
+    for(size_t i = begin; i < end; i++)
+        c.radius = std::max(c.radius, (pts[order[i]] - center).magnitude());
+
+    if(!c.leaf)
+    {
+        size_t bounds[9];
+        bounds[0] = begin;
+
+        size_t next = begin;
+        for(int oct = 0; oct < 8; oct++)
+        {
+            for(size_t i = next; i < end; i++)
+            {
+                const vec3 &s = pts[order[i]];
+                int o = 0;
+                for(int k = 0; k < 3; k++)
+                    if(s[k] >= center[k])
+                        o |= 1 << k;
+
+                if(o == oct)
+                    std::swap(order[i], order[next++]);
+            }
+            bounds[oct + 1] = next;
+        }
+
+        for(int oct = 0; oct < 8; oct++)
+        {
+            if(bounds[oct] == bounds[oct + 1])
+            {
+                c.children[oct] = -1;
+                continue;
+            }
+
+            vec3 cc = center;
+            for(int k = 0; k < 3; k++)
+                cc[k] += (oct & (1 << k)) ? width / 4 : -width / 4;
+
+            c.children[oct] = cells.size();
+            build_cells(pts, order, cells, cc, width / 2, bounds[oct], bounds[oct + 1], depth + 1);
+        }
+    }
+
+    cells[idx] = c;
+}
+
+/* an octree over pts; cells come out in pre-order (parents first) */
+void build_tree(const vector<vec3> &pts, vector<size_t> &order, vector<FMM::Cell> &cells)
+{
+    cells.clear();
+    order.resize(pts.size());
+    for(size_t i = 0; i < pts.size(); i++)
+        order[i] = i;
+
+    if(pts.empty())
+        return;
+
+    vec3 lo = pts[0], hi = pts[0];
+    for(const vec3 &s : pts)
+        for(int k = 0; k < 3; k++)
+        {
+            lo[k] = std::min(lo[k], s[k]);
+            hi[k] = std::max(hi[k], s[k]);
+        }
+
+    scalar width = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    if(width <= 0)
+        width = 1;
+
+    build_cells(pts, order, cells, (lo + hi) / 2, width, 0, pts.size(), 0);
+}
+
+}
+
+void FMM::clear()
+{
+    pos.clear();
+    strength.clear();
+    cells.clear();
+    order_of.clear();
+    multipoles.clear();
+}
+
+void FMM::add(vec3 s, vec3 J)
+{
+    pos.push_back(s);
+    for(int k = 0; k < 3; k++)
+        strength.push_back(J[k]);
+}
+
+void FMM::add(vec3 s, scalar q)
+{
+    pos.push_back(s);
+    strength.push_back(q);
+}
+
+void FMM::build(int order)
+{
+    p = order;
+
+    build_tree(pos, order_of, cells);
+
+    Tables tab(p);
+    int nt = tab.terms();
+    multipoles.assign(cells.size() * nc() * nt, 0);
+
+    vector<scalar> pw(nt);
+
+    /* children follow their parents, so walking backwards is an
+     * upward pass */
+    for(size_t ci = cells.size(); ci-- > 0; )
+    {
+        const Cell &c = cells[ci];
+        scalar *M = &multipoles[ci * nc() * nt];
+
+        if(c.leaf)
+        {
+            /* P2M */
+            for(size_t e = c.begin; e < c.end; e++)
+            {
+                size_t el = order_of[e];
+                tab.mi.powers(pos[el] - c.center, p, &pw[0]);
+
+                for(int comp = 0; comp < nc(); comp++)
+                {
+                    scalar s = strength[el * nc() + comp];
+                    for(int t = 0; t < nt; t++)
+                        M[comp * nt + t] += s * pw[t];
+                }
+            }
+            continue;
+        }
+
+        /* M2M: (d' + t)^a = sum_{k <= a} C(a, k) d'^k t^(a - k) */
+        for(int oct = 0; oct < 8; oct++)
+        {
+            int ch = c.children[oct];
+            if(ch < 0)
+                continue;
+
+            const scalar *Mc = &multipoles[ch * nc() * nt];
+            tab.mi.powers(cells[ch].center - c.center, p, &pw[0]);
+
+            for(int a = 0; a < nt; a++)
+            {
+                int ai = tab.mi.i[a], aj = tab.mi.j[a], ak = tab.mi.k[a];
+
+                for(int ki = 0; ki <= ai; ki++)
+                    for(int kj = 0; kj <= aj; kj++)
+                        for(int kk = 0; kk <= ak; kk++)
+                        {
+                            int kt = tab.mi.index(ki, kj, kk);
+                            scalar coef = tab.binom[ai][ki] * tab.binom[aj][kj] * tab.binom[ak][kk] *
+                                pw[tab.mi.index(ai - ki, aj - kj, ak - kk)];
+
+                            for(int comp = 0; comp < nc(); comp++)
+                                M[comp * nt + a] += coef * Mc[comp * nt + kt];
+                        }
+            }
+        }
+    }
+}
+
+void FMM::evaluate(const vector<vec3> &targets, vector<vec3> &out, ThreadPool &pool,
+                   Progress *progress) const
+{
+    out.assign(targets.size(), vec3(0));
+
+    if(targets.empty() || cells.empty())
+        return;
+
+    Tables tab(p);
+    int nt = tab.terms(), ncomp = nc();
+
+    vector<Cell> tcells;
+    vector<size_t> torder;
+    build_tree(targets, torder, tcells);
+
+    /* A translation costs about as much as this many direct pairs;
+     * cheaper pairs of cells are summed directly even when separated. */
+    size_t m2l_cost = (size_t)nt * nt * ncomp / 4;
+
+    /* pair off target and source cells; direct sums are only recorded
+     * on target leaves, so no two threads write the same target */
+    vector<vector<int>> m2l(tcells.size()), p2p(tcells.size());
+
+    vector<std::pair<int, int>> work(1, std::make_pair(0, 0));
+    while(!work.empty())
+    {
+        int t = work.back().first, s = work.back().second;
+        work.pop_back();
+
+        const Cell &tc = tcells[t], &sc = cells[s];
+        scalar dist = (tc.center - sc.center).magnitude();
+
+        bool separated = tc.radius + sc.radius < FMM_THETA * dist;
+        bool small = (tc.end - tc.begin) * (sc.end - sc.begin) < m2l_cost;
+
+        if(separated && !small)
+            m2l[t].push_back(s);
+        else if(tc.leaf && (sc.leaf || separated))
+            p2p[t].push_back(s);
+        else if(separated)
+        {
+            for(int oct = 0; oct < 8; oct++)
+                if(tc.children[oct] >= 0)
+                    work.push_back(std::make_pair(tc.children[oct], s));
+        }
+        else if(sc.leaf || (!tc.leaf && tc.width >= sc.width))
+        {
+            for(int oct = 0; oct < 8; oct++)
+                if(tc.children[oct] >= 0)
+                    work.push_back(std::make_pair(tc.children[oct], s));
+        }
+        else
+        {
+            for(int oct = 0; oct < 8; oct++)
+                if(sc.children[oct] >= 0)
+                    work.push_back(std::make_pair(t, sc.children[oct]));
+        }
+    }
+
+    /* gradient of each potential at each (permuted) target */
+    vector<scalar> locals(tcells.size() * ncomp * nt, 0);
+    vector<scalar> grad(targets.size() * ncomp * 3, 0);
+
+    if(progress)
+        progress->add_total(2 * tcells.size());
+
+    pool.parallel_for(tcells.size(), [&](size_t t) {
+            if(progress)
+            {
+                progress->advance(1);
+                if(progress->cancelled())
+                    return;
+            }
+
+            TraceSpan span("field", "fmm interactions");
+
+            const Cell &tc = tcells[t];
+            scalar *L = &locals[t * ncomp * nt];
+
+            /* M2L: L_b = sum_a (-1)^|a| C(a + b, a) M_a D^(a+b)(1/R) / (a + b)! */
+            vector<scalar> a(MultiIndex::terms(2 * p));
+            for(int s : m2l[t])
+            {
+                tab.derivatives(tc.center - cells[s].center, &a[0]);
+                const scalar *M = &multipoles[s * ncomp * nt];
+
+                for(int b = 0; b < nt; b++)
+                    for(const Tables::Pair &pr : tab.m2l[b])
+                    {
+                        scalar k = pr.coef * a[pr.gamma];
+                        for(int comp = 0; comp < ncomp; comp++)
+                            L[comp * nt + b] += k * M[comp * nt + pr.alpha];
+                    }
+            }
+
+            /* P2P: grad (s / |x - y|) = -s (x - y) / |x - y|^3 */
+            for(int s : p2p[t])
+            {
+                const Cell &sc = cells[s];
+                for(size_t ti = tc.begin; ti < tc.end; ti++)
+                {
+                    const vec3 &x = targets[torder[ti]];
+                    scalar *g = &grad[ti * ncomp * 3];
+
+                    for(size_t e = sc.begin; e < sc.end; e++)
+                    {
+                        size_t el = order_of[e];
+                        vec3 r = x - pos[el];
+                        scalar r2 = r.magnitudeSquared();
+                        scalar inv = 1 / (r2 * std::sqrt(r2));
+
+                        for(int comp = 0; comp < ncomp; comp++)
+                        {
+                            scalar k = -strength[el * ncomp + comp] * inv;
+                            for(int d = 0; d < 3; d++)
+                                g[comp * 3 + d] += k * r[d];
+                        }
+                    }
+                }
+            }
+        });
+
+    if(progress && progress->cancelled())
+        return;
+
+    /* L2L, parents before children:
+     * L'_k = sum_{b >= k} C(b, k) L_b u^(b - k) */
+    vector<scalar> pw(nt);
+    for(size_t t = 0; t < tcells.size(); t++)
+    {
+        const Cell &tc = tcells[t];
+        if(tc.leaf)
+            continue;
+
+        const scalar *L = &locals[t * ncomp * nt];
+
+        for(int oct = 0; oct < 8; oct++)
+        {
+            int ch = tc.children[oct];
+            if(ch < 0)
+                continue;
+
+            scalar *Lc = &locals[ch * ncomp * nt];
+            tab.mi.powers(tcells[ch].center - tc.center, p, &pw[0]);
+
+            for(int b = 0; b < nt; b++)
+            {
+                int bi = tab.mi.i[b], bj = tab.mi.j[b], bk = tab.mi.k[b];
+
+                for(int ki = 0; ki <= bi; ki++)
+                    for(int kj = 0; kj <= bj; kj++)
+                        for(int kk = 0; kk <= bk; kk++)
+                        {
+                            int kt = tab.mi.index(ki, kj, kk);
+                            scalar coef = tab.binom[bi][ki] * tab.binom[bj][kj] * tab.binom[bk][kk] *
+                                pw[tab.mi.index(bi - ki, bj - kj, bk - kk)];
+
+                            for(int comp = 0; comp < ncomp; comp++)
+                                Lc[comp * nt + kt] += coef * L[comp * nt + b];
+                        }
+            }
+        }
+    }
+
+    /* L2P: d/dx_k (x - z)^b = b_k (x - z)^(b - e_k) */
+    pool.parallel_for(tcells.size(), [&](size_t t) {
+            if(progress)
+                progress->advance(1);
+
+            const Cell &tc = tcells[t];
+            if(!tc.leaf || (progress && progress->cancelled()))
+                return;
+
+            TraceSpan span("field", "fmm local to points");
+
+            const scalar *L = &locals[t * ncomp * nt];
+            vector<scalar> pw(MultiIndex::terms(p));
+
+            for(size_t ti = tc.begin; ti < tc.end; ti++)
+            {
+                tab.mi.powers(targets[torder[ti]] - tc.center, p, &pw[0]);
+                scalar *g = &grad[ti * ncomp * 3];
+
+                for(int b = 1; b < nt; b++)
+                {
+                    int c[3] = { tab.mi.i[b], tab.mi.j[b], tab.mi.k[b] };
+
+                    for(int d = 0; d < 3; d++)
+                    {
+                        if(!c[d])
+                            continue;
+
+                        int e[3] = { c[0], c[1], c[2] };
+                        e[d] -= 1;
+                        scalar k = c[d] * pw[tab.mi.index(e[0], e[1], e[2])];
+
+                        for(int comp = 0; comp < ncomp; comp++)
+                            g[comp * 3 + d] += k * L[comp * nt + b];
+                    }
+                }
+            }
+        });
+
+    for(size_t ti = 0; ti < targets.size(); ti++)
+    {
+        const scalar *g = &grad[ti * ncomp * 3];
+        vec3 f;
+
+        if(kind == CHARGE)
+            f = vec3(-g[0], -g[1], -g[2]);
+        else
+        {
+            /* g[comp * 3 + d] = dA_comp / dx_d */
+            f = vec3(g[2 * 3 + 1] - g[1 * 3 + 2],
+                     g[0 * 3 + 2] - g[2 * 3 + 0],
+                     g[1 * 3 + 0] - g[0 * 3 + 1]);
+        }
+
+        out[torder[ti]] = f;
+    }
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,85 @@
+#ifndef FIELDVIZ_FMM_H
+#define FIELDVIZ_FMM_H
+
+#include <cstddef>
+#include <vector>
+
+#include <fml/fml.h>
+
+#include "progress.h"
+#include "threadpool.h"
+
+namespace fieldviz {
+
+/* Fast multipole evaluation of the fields of many source elements at
+ * many targets at once.
+ *
+ * Both fields are derivatives of Laplace potentials,
+ *
+ *   E = -grad phi,  phi = sum q / |r|
+ *   B = curl A,     A   = sum J / |r|
+ *
+ * so this is a Cartesian (Taylor series) FMM on one or three scalar
+ * potentials.  Sources and targets each get an octree; a dual-tree walk
+ * pairs off well-separated cells, whose source multipoles are
+ * translated into target local expansions (M2L), and sums the rest
+ * directly.  Expansions are truncated at total degree `order', which
+ * sets the accuracy; cost grows roughly as order^6 per translation but
+ * only linearly with the number of sources plus targets. */
+class FMM {
+public:
+    enum Kind { CURRENT, CHARGE };
+
+    explicit FMM(Kind kind = CURRENT) : kind(kind) {}
+
+    void clear();
+
+    /* for current solvers */
+    void add(fml::vec3 pos, fml::vec3 J);
+
+    /* for charge solvers */
+    void add(fml::vec3 pos, fml::scalar q);
+
+    /* build the source tree and its multipoles at the given order */
+    void build(int order);
+
+    /* out[i] = field at targets[i] (B for CURRENT, E for CHARGE),
+     * counting target cells done in each pass towards progress; stops
+     * early, leaving out incomplete, if it is cancelled */
+    void evaluate(const std::vector<fml::vec3> &targets,
+                  std::vector<fml::vec3> &out,
+                  ThreadPool &pool, Progress *progress = NULL) const;
+
+    size_t size() const { return pos.size(); }
+    int order() const { return p; }
+
+    /* a cube of cells, its points [begin, end) of the permuted order */
+    struct Cell {
+        fml::vec3 center;
+        fml::scalar width;
+        fml::scalar radius; /* of the points about center */
+        size_t begin, end;
+        int children[8];
+        bool leaf;
+    };
+
+private:
+    Kind kind;
+    int p = 0;
+
+    /* number of potentials: 3 (A) or 1 (phi) */
+    int nc() const { return kind == CURRENT ? 3 : 1; }
+
+    std::vector<fml::vec3> pos;
+    std::vector<fml::scalar> strength; /* nc() per element */
+
+    std::vector<Cell> cells;
+    std::vector<size_t> order_of; /* permutation of elements into cells */
+
+    /* nc() * terms(p) multipole coefficients per cell */
+    std::vector<fml::scalar> multipoles;
+};
+
+} /* namespace fieldviz */
+
+#endif
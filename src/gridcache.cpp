@@ -0,0 +1,79 @@
+#include "gridcache.h"
+
+using namespace fml;
+
+namespace fieldviz {
+
+static bool same(vec3 a, vec3 b)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+bool GridKey::operator==(const GridKey &o) const
+{
+    return type == o.type && same(lower, o.lower) && same(upper, o.upper) && delta == o.delta;
+}
+
+void GridCache::set_capacity(size_t n)
+{
+    max_grids = n;
+    while(grids.size() > max_grids)
+        grids.pop_back();
+}
+
+void GridCache::set_byte_limit(size_t bytes)
+{
+    max_bytes = bytes;
+    while(!grids.empty() && this->bytes() > max_bytes)
+        grids.pop_back();
+}
+
+size_t GridCache::bytes() const
+{
+    size_t n = 0;
+    for(const Grid &g : grids)
+        n += g.bytes();
+    return n;
+}
+
+GridCache::Grid *GridCache::find(const GridKey &key)
+{
+    for(auto i = grids.begin(); i != grids.end(); i++)
+    {
+        if(i->key == key)
+        {
+            grids.splice(grids.begin(), grids, i);
+            return &grids.front();
+        }
+    }
+
+    return NULL;
+}
+
+GridCache::Grid &GridCache::insert(const GridKey &key, size_t points)
+{
+    while(!grids.empty() && grids.size() >= max_grids)
+        grids.pop_back();
+
+    grids.emplace_front(key, points);
+    return grids.front();
+}
+
+void GridCache::make_room(size_t need)
+{
+    while(grids.size() > 1 && bytes() - grids.front().bytes() + need > max_bytes)
+        grids.pop_back();
+}
+
+void GridCache::erase(const GridKey &key)
+{
+    grids.remove_if([&](const Grid &g) { return g.key == key; });
+}
+
+void GridCache::remove_entity(int id)
+{
+    for(Grid &g : grids)
+        g.remove(id);
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,70 @@
+#ifndef FIELDVIZ_GRIDCACHE_H
+#define FIELDVIZ_GRIDCACHE_H
+
+#include <cstddef>
+#include <list>
+
+#include <fml/fml.h>
+
+#include "basis.h"
+
+namespace fieldviz {
+
+/* identifies a field grid: which field, the region, and the spacing */
+struct GridKey {
+    int type;
+    fml::vec3 lower, upper;
+    fml::scalar delta;
+
+    bool operator==(const GridKey &o) const;
+};
+
+/* The last few field grids, each kept as per-source basis fields so
+ * that `add', `delete' and `set' only redo what changed.  Both the
+ * number of grids and the memory they take are capped; least recently
+ * used grids go first. */
+class GridCache {
+public:
+    struct Grid : BasisField {
+        GridKey key;
+
+        Grid(const GridKey &key, size_t points) : BasisField(points), key(key) {}
+    };
+
+    GridCache(size_t capacity, size_t max_bytes) : max_grids(capacity), max_bytes(max_bytes) {}
+
+    size_t capacity() const { return max_grids; }
+    void set_capacity(size_t n);
+
+    size_t byte_limit() const { return max_bytes; }
+    void set_byte_limit(size_t bytes);
+
+    size_t size() const { return grids.size(); }
+    size_t bytes() const;
+
+    /* the cached grid for key, made most recently used, or NULL */
+    Grid *find(const GridKey &key);
+
+    /* a new, empty grid for key, evicting the oldest if full */
+    Grid &insert(const GridKey &key, size_t points);
+
+    /* evict the oldest grids other than the most recently used until
+     * it can grow to need bytes within the limit */
+    void make_room(size_t need);
+
+    /* forget the grid for key, if cached */
+    void erase(const GridKey &key);
+
+    /* forget one source's contribution to every grid */
+    void remove_entity(int id);
+
+    void clear() { grids.clear(); }
+
+private:
+    size_t max_grids, max_bytes;
+    std::list<Grid> grids;
+};
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,132 @@
+#include "hwcounters.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fieldviz {
+
+std::atomic<bool> hw_enabled{false};
+
+#ifdef __linux__
+
+namespace {
+
+const uint64_t events[HW_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/* one counter group per thread, closed when the thread exits */
+struct ThreadCounters {
+    int fds[HW_EVENTS];
+    int error = 0;
+    bool opened = false;
+
+    ThreadCounters()
+    {
+        for(int i = 0; i < HW_EVENTS; i++)
+            fds[i] = -1;
+    }
+
+    ~ThreadCounters()
+    {
+        for(int i = 0; i < HW_EVENTS; i++)
+            if(fds[i] >= 0)
+                close(fds[i]);
+    }
+
+    bool open()
+    {
+        if(opened)
+            return !error;
+        opened = true;
+
+        for(int i = 0; i < HW_EVENTS; i++)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[i];
+            attr.disabled = (i == 0);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            /* this thread, any CPU, in the first counter's group */
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i ? fds[0] : -1, 0);
+            if(fds[i] < 0)
+            {
+                error = errno;
+                return false;
+            }
+        }
+
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    bool read(HwCounts &c)
+    {
+        if(!open())
+            return false;
+
+        uint64_t buf[1 + HW_EVENTS];
+        if(::read(fds[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[0] != HW_EVENTS)
+            return false;
+
+        for(int i = 0; i < HW_EVENTS; i++)
+            c.v[i] = buf[1 + i];
+        return true;
+    }
+};
+
+thread_local ThreadCounters counters;
+
+}
+
+bool hw_read(HwCounts &c)
+{
+    return counters.read(c);
+}
+
+bool hw_available(std::string &why)
+{
+    HwCounts c;
+    if(hw_read(c))
+        return true;
+
+    why = counters.error ? strerror(counters.error) : "cannot read counters";
+    if(counters.error == EACCES || counters.error == EPERM)
+        why += " (see /proc/sys/kernel/perf_event_paranoid)";
+    else if(counters.error == ENOENT || counters.error == EOPNOTSUPP)
+        why = "no hardware counters on this CPU or VM";
+    return false;
+}
+
+#else
+
+bool hw_read(HwCounts &)
+{
+    return false;
+}
+
+bool hw_available(std::string &why)
+{
+    why = "only supported on Linux";
+    return false;
+}
+
+#endif
+
+} /* namespace fieldviz */
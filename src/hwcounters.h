@@ -0,0 +1,69 @@
+#ifndef FIELDVIZ_HWCOUNTERS_H
+#define FIELDVIZ_HWCOUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace fieldviz {
+
+/* CPU performance counters for the calling thread, in user mode only,
+ * through Linux's perf_event_open().  Each thread opens its own set the
+ * first time it reads them.  Elsewhere, or where the kernel does not
+ * allow it (perf_event_paranoid, containers, VMs without a PMU), they
+ * are simply unavailable. */
+
+enum HwEvent { HW_CYCLES, HW_INSTRUCTIONS, HW_CACHE_MISSES, HW_BRANCH_MISSES, HW_EVENTS };
+
+struct HwCounts {
+    uint64_t v[HW_EVENTS] = {};
+
+    HwCounts operator-(const HwCounts &o) const
+    {
+        HwCounts d;
+        for(int i = 0; i < HW_EVENTS; i++)
+            d.v[i] = v[i] - o.v[i];
+        return d;
+    }
+};
+
+/* Read the calling thread's counters; false if they are unavailable.
+ * A read is a system call, so this is for code that does a good deal
+ * of work between reads. */
+bool hw_read(HwCounts &c);
+
+/* true if counters can be opened; otherwise why sets the reason */
+bool hw_available(std::string &why);
+
+/* whether the profiler should sample them (`profile hw') */
+extern std::atomic<bool> hw_enabled;
+
+inline bool hw_counting()
+{
+    return hw_enabled.load(std::memory_order_relaxed);
+}
+
+/* Counts accumulated from any number of threads */
+struct HwTotals {
+    std::atomic<uint64_t> v[HW_EVENTS] = {};
+
+    void add(const HwCounts &c)
+    {
+        for(int i = 0; i < HW_EVENTS; i++)
+            v[i].fetch_add(c.v[i], std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for(int i = 0; i < HW_EVENTS; i++)
+            v[i] = 0;
+    }
+
+    bool empty() const { return !v[HW_CYCLES] && !v[HW_INSTRUCTIONS]; }
+
+    double ipc() const { return v[HW_CYCLES] ? (double)v[HW_INSTRUCTIONS] / v[HW_CYCLES] : 0; }
+};
+
+} /* namespace fieldviz */
+
+#endif
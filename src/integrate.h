@@ -0,0 +1,44 @@
+#ifndef FIELDVIZ_INTEGRATE_H
+#define FIELDVIZ_INTEGRATE_H
+
+#include <fml/fml.h>
+
+namespace fieldviz {
+
+/* Manifold::integrate() only accepts a plain function pointer, so it
+ * cannot carry any state of its own.  for_each_sample() bridges that
+ * to an arbitrary callable: the callable is published through a
+ * thread-local slot that a captureless trampoline reads back.  The
+ * slot is saved and restored around the call, so nested and
+ * concurrent (one per thread) integrations are both safe, and no
+ * locking is involved. */
+
+template<typename F>
+struct SampleVisitor {
+    static thread_local F *current;
+
+    static fml::vec3 trampoline(fml::vec3 s, fml::vec3 ds)
+    {
+        (*current)(s, ds);
+        return 0;
+    }
+};
+
+template<typename F>
+thread_local F *SampleVisitor<F>::current = nullptr;
+
+/* call f(s, ds) for every sample of m at fineness delta */
+template<typename F>
+void for_each_sample(fml::Manifold *m, fml::scalar delta, F &f)
+{
+    F *saved = SampleVisitor<F>::current;
+    SampleVisitor<F>::current = &f;
+
+    m->integrate(SampleVisitor<F>::trampoline, delta);
+
+    SampleVisitor<F>::current = saved;
+}
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,290 @@
+#include "kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace fml;
+
+namespace fieldviz {
+
+static vec3 biot_savart_scalar(const SampleSet &s, vec3 point)
+{
+    BiotSavart k(point);
+    s.for_each(k);
+    return k.B;
+}
+
+static vec3 coulomb_scalar(const SampleSet &s, vec3 point)
+{
+    Coulomb k(point);
+    s.for_each(k);
+    return k.E;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* the vector loops' leftover samples, in the same arithmetic order */
+static inline scalar inv_r3(scalar rx, scalar ry, scalar rz)
+{
+    scalar r2 = rx * rx + ry * ry + rz * rz;
+    return 1 / (r2 * std::sqrt(r2));
+}
+
+__attribute__((target("avx2,fma")))
+static inline scalar hsum_avx2(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v), hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+/* shared by both AVX2 kernels: r = p - s and 1 / |r|^3 for four samples */
+#define AVX2_LOAD_R(i)                                                  \
+    __m256d rx = _mm256_sub_pd(px, _mm256_loadu_pd(&s.x[i]));           \
+    __m256d ry = _mm256_sub_pd(py, _mm256_loadu_pd(&s.y[i]));           \
+    __m256d rz = _mm256_sub_pd(pz, _mm256_loadu_pd(&s.z[i]));           \
+    __m256d r2 = _mm256_fmadd_pd(rz, rz,                                \
+                   _mm256_fmadd_pd(ry, ry, _mm256_mul_pd(rx, rx)));     \
+    __m256d inv = _mm256_div_pd(one, _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)))
+
+__attribute__((target("avx2,fma")))
+static vec3 biot_savart_avx2(const SampleSet &s, vec3 p)
+{
+    size_t n = s.size(), i = 0;
+
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+    __m256d bx = _mm256_setzero_pd(), by = _mm256_setzero_pd(), bz = _mm256_setzero_pd();
+
+    for(; i + 4 <= n; i += 4)
+    {
+        AVX2_LOAD_R(i);
+
+        __m256d dx = _mm256_loadu_pd(&s.dx[i]);
+        __m256d dy = _mm256_loadu_pd(&s.dy[i]);
+        __m256d dz = _mm256_loadu_pd(&s.dz[i]);
+
+        /* ds x r */
+        __m256d cx = _mm256_fmsub_pd(dy, rz, _mm256_mul_pd(dz, ry));
+        __m256d cy = _mm256_fmsub_pd(dz, rx, _mm256_mul_pd(dx, rz));
+        __m256d cz = _mm256_fmsub_pd(dx, ry, _mm256_mul_pd(dy, rx));
+
+        bx = _mm256_fmadd_pd(cx, inv, bx);
+        by = _mm256_fmadd_pd(cy, inv, by);
+        bz = _mm256_fmadd_pd(cz, inv, bz);
+    }
+
+    vec3 B(hsum_avx2(bx), hsum_avx2(by), hsum_avx2(bz));
+
+    for(; i < n; i++)
+    {
+        vec3 r = p - s.position(i);
+        B += s.element(i).cross(r) * inv_r3(r[0], r[1], r[2]);
+    }
+
+    return B;
+}
+
+__attribute__((target("avx2,fma")))
+static vec3 coulomb_avx2(const SampleSet &s, vec3 p)
+{
+    size_t n = s.size(), i = 0;
+
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+    __m256d ex = _mm256_setzero_pd(), ey = _mm256_setzero_pd(), ez = _mm256_setzero_pd();
+
+    for(; i + 4 <= n; i += 4)
+    {
+        AVX2_LOAD_R(i);
+
+        __m256d k = _mm256_mul_pd(_mm256_loadu_pd(&s.w[i]), inv);
+
+        ex = _mm256_fmadd_pd(rx, k, ex);
+        ey = _mm256_fmadd_pd(ry, k, ey);
+        ez = _mm256_fmadd_pd(rz, k, ez);
+    }
+
+    vec3 E(hsum_avx2(ex), hsum_avx2(ey), hsum_avx2(ez));
+
+    for(; i < n; i++)
+    {
+        vec3 r = p - s.position(i);
+        E += r * (s.w[i] * inv_r3(r[0], r[1], r[2]));
+    }
+
+    return E;
+}
+
+/* r = p - s and 1 / |r|^3 for up to eight samples selected by m */
+#define AVX512_LOAD_R(i, m)                                                     \
+    __m512d rx = _mm512_sub_pd(px, _mm512_maskz_loadu_pd(m, &s.x[i]));          \
+    __m512d ry = _mm512_sub_pd(py, _mm512_maskz_loadu_pd(m, &s.y[i]));          \
+    __m512d rz = _mm512_sub_pd(pz, _mm512_maskz_loadu_pd(m, &s.z[i]));          \
+    __m512d r2 = _mm512_fmadd_pd(rz, rz,                                        \
+                   _mm512_fmadd_pd(ry, ry, _mm512_mul_pd(rx, rx)));             \
+    __m512d inv = _mm512_div_pd(one, _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)))
+
+__attribute__((target("avx512f")))
+static vec3 biot_savart_avx512(const SampleSet &s, vec3 p)
+{
+    size_t n = s.size();
+
+    const __m512d one = _mm512_set1_pd(1);
+    const __m512d px = _mm512_set1_pd(p[0]), py = _mm512_set1_pd(p[1]), pz = _mm512_set1_pd(p[2]);
+    __m512d bx = _mm512_setzero_pd(), by = _mm512_setzero_pd(), bz = _mm512_setzero_pd();
+
+    for(size_t i = 0; i < n; i += 8)
+    {
+        /* the tail is masked rather than finished in scalar code */
+        __mmask8 m = n - i >= 8 ? 0xff : (__mmask8)((1u << (n - i)) - 1);
+
+        AVX512_LOAD_R(i, m);
+
+        __m512d dx = _mm512_maskz_loadu_pd(m, &s.dx[i]);
+        __m512d dy = _mm512_maskz_loadu_pd(m, &s.dy[i]);
+        __m512d dz = _mm512_maskz_loadu_pd(m, &s.dz[i]);
+
+        __m512d cx = _mm512_fmsub_pd(dy, rz, _mm512_mul_pd(dz, ry));
+        __m512d cy = _mm512_fmsub_pd(dz, rx, _mm512_mul_pd(dx, rz));
+        __m512d cz = _mm512_fmsub_pd(dx, ry, _mm512_mul_pd(dy, rx));
+
+        /* masked-off lanes may hold inf * 0; leave the sums alone there */
+        bx = _mm512_mask3_fmadd_pd(cx, inv, bx, m);
+        by = _mm512_mask3_fmadd_pd(cy, inv, by, m);
+        bz = _mm512_mask3_fmadd_pd(cz, inv, bz, m);
+    }
+
+    return vec3(_mm512_reduce_add_pd(bx), _mm512_reduce_add_pd(by), _mm512_reduce_add_pd(bz));
+}
+
+__attribute__((target("avx512f")))
+static vec3 coulomb_avx512(const SampleSet &s, vec3 p)
+{
+    size_t n = s.size();
+
+    const __m512d one = _mm512_set1_pd(1);
+    const __m512d px = _mm512_set1_pd(p[0]), py = _mm512_set1_pd(p[1]), pz = _mm512_set1_pd(p[2]);
+    __m512d ex = _mm512_setzero_pd(), ey = _mm512_setzero_pd(), ez = _mm512_setzero_pd();
+
+    for(size_t i = 0; i < n; i += 8)
+    {
+        __mmask8 m = n - i >= 8 ? 0xff : (__mmask8)((1u << (n - i)) - 1);
+
+        AVX512_LOAD_R(i, m);
+
+        __m512d k = _mm512_mul_pd(_mm512_maskz_loadu_pd(m, &s.w[i]), inv);
+
+        ex = _mm512_mask3_fmadd_pd(rx, k, ex, m);
+        ey = _mm512_mask3_fmadd_pd(ry, k, ey, m);
+        ez = _mm512_mask3_fmadd_pd(rz, k, ez, m);
+    }
+
+    return vec3(_mm512_reduce_add_pd(ex), _mm512_reduce_add_pd(ey), _mm512_reduce_add_pd(ez));
+}
+
+static bool isa_supported(KernelISA isa)
+{
+    /* this runs during static initialization, possibly before libgcc
+     * has filled in the CPU model itself */
+    __builtin_cpu_init();
+
+    switch(isa)
+    {
+    case ISA_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case ISA_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return true;
+    }
+}
+
+#else
+
+static bool isa_supported(KernelISA isa)
+{
+    return isa == ISA_SCALAR;
+}
+
+#endif
+
+typedef vec3 (*SampleKernel)(const SampleSet &s, vec3 point);
+
+static KernelISA active_isa = ISA_SCALAR;
+static SampleKernel active_biot_savart = biot_savart_scalar;
+static SampleKernel active_coulomb = coulomb_scalar;
+
+/* pick the widest kernels before main() runs */
+static KernelISA initial_isa = set_kernel_isa(ISA_AUTO);
+
+KernelISA set_kernel_isa(KernelISA isa)
+{
+    if(isa == ISA_AUTO)
+    {
+        if(isa_supported(ISA_AVX512))
+            isa = ISA_AVX512;
+        else if(isa_supported(ISA_AVX2))
+            isa = ISA_AVX2;
+        else
+            isa = ISA_SCALAR;
+    }
+    else if(!isa_supported(isa))
+        isa = ISA_SCALAR;
+
+    switch(isa)
+    {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX512:
+        active_biot_savart = biot_savart_avx512;
+        active_coulomb = coulomb_avx512;
+        break;
+    case ISA_AVX2:
+        active_biot_savart = biot_savart_avx2;
+        active_coulomb = coulomb_avx2;
+        break;
+#endif
+    default:
+        isa = ISA_SCALAR;
+        active_biot_savart = biot_savart_scalar;
+        active_coulomb = coulomb_scalar;
+        break;
+    }
+
+    active_isa = isa;
+    return isa;
+}
+
+KernelISA kernel_isa()
+{
+    return active_isa;
+}
+
+const char *kernel_isa_name(KernelISA isa)
+{
+    switch(isa)
+    {
+    case ISA_AVX2:
+        return "avx2";
+    case ISA_AVX512:
+        return "avx512";
+    case ISA_SCALAR:
+        return "scalar";
+    default:
+        return "auto";
+    }
+}
+
+vec3 biot_savart(const SampleSet &s, vec3 point)
+{
+    return active_biot_savart(s, point);
+}
+
+vec3 coulomb(const SampleSet &s, vec3 point)
+{
+    return active_coulomb(s, point);
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,78 @@
+#ifndef FIELDVIZ_KERNELS_H
+#define FIELDVIZ_KERNELS_H
+
+#include <fml/fml.h>
+
+#include "sources.h"
+
+namespace fieldviz {
+
+/* Sums of the field integrands over a SampleSet, before the physical
+ * constants and source strength are applied:
+ *
+ *   biot_savart(s, p) = sum ds x r / |r|^3
+ *   coulomb(s, p)     = sum |ds| r / |r|^3,   r = p - s
+ *
+ * The vectorized implementations split the sum into one partial sum per
+ * lane and compute 1/|r|^3 in a different order than the scalar code,
+ * so results are not bitwise identical.  They agree with the scalar
+ * kernel to within KERNEL_TOLERANCE times the sum of the magnitudes of
+ * the individual terms (a few ulps per term in practice). */
+
+const fml::scalar KERNEL_TOLERANCE = 1e-12;
+
+enum KernelISA { ISA_AUTO, ISA_SCALAR, ISA_AVX2, ISA_AVX512 };
+
+/* dl x r / (|r| ^ 2) */
+struct BiotSavart {
+    fml::vec3 point;
+    fml::vec3 B = 0;
+
+    BiotSavart(fml::vec3 point) : point(point) {}
+
+    void operator()(fml::vec3 s, fml::vec3 ds, fml::scalar)
+    {
+        fml::vec3 r = point - s;
+
+        fml::scalar r2 = r.magnitudeSquared();
+
+        fml::vec3 rnorm = r / std::sqrt(r2);
+
+        B += ds.cross(rnorm) / r2;
+    }
+};
+
+/* dl * r / (|r| ^ 2) */
+struct Coulomb {
+    fml::vec3 point;
+    fml::vec3 E = 0;
+
+    Coulomb(fml::vec3 point) : point(point) {}
+
+    void operator()(fml::vec3 s, fml::vec3, fml::scalar w)
+    {
+        fml::vec3 r = point - s;
+
+        fml::scalar r2 = r.magnitudeSquared();
+
+        fml::vec3 rnorm = r / std::sqrt(r2);
+
+        E += rnorm * w / r2;
+    }
+};
+
+fml::vec3 biot_savart(const SampleSet &s, fml::vec3 point);
+fml::vec3 coulomb(const SampleSet &s, fml::vec3 point);
+
+/* Select the implementation used by biot_savart() and coulomb().
+ * ISA_AUTO picks the widest one this CPU supports.  Returns the ISA
+ * actually selected, which is ISA_SCALAR if the request is not
+ * supported.  The selection is global to the process, shared by every
+ * Scene, and must not change while any field is being evaluated. */
+KernelISA set_kernel_isa(KernelISA isa);
+KernelISA kernel_isa();
+const char *kernel_isa_name(KernelISA isa);
+
+} /* namespace fieldviz */
+
+#endif
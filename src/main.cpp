@@ -1,289 +1,697 @@
+#include <chrono>
 #include <cmath>
 #include <csignal>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "gnuplot_i.hpp"
+#include "fieldline.h"
+#include "gridcache.h"
+#include "kernels.h"
+#include "profile.h"
+#include "scene.h"
+#include "trace.h"
+#include "writer.h"
 
 #include <fml/fml.h>
 
 // under $HOME
 #define HISTORY_FILE ".fieldviz_history"
 
+using namespace fieldviz;
 using namespace fml;
 using namespace std;
 
-/* A current or charge distribution */
-struct Entity {
-    /* can bitwise-OR together */
-    enum { CHARGE = 1 << 0, CURRENT = 1 << 1 } type;
-    union {
-        scalar Q_density; /* linear charge density */
-        scalar I; /* current */
-    };
+Scene scene;
 
-    Manifold *path;
-};
+/* how `field' hands its grid to gnuplot */
+enum Output { OUTPUT_TEXT, OUTPUT_BINARY };
+Output output = OUTPUT_TEXT;
+BinaryFormat binary_format = FLOAT32;
 
-vec3 point;
+/* grid points checked against the direct sum after an FMM evaluation */
+const size_t FMM_CHECK_POINTS = 64;
 
-/* dl x r / (|r| ^ 2) */
-vec3 dB(vec3 s, vec3 ds)
-{
-    vec3 r = point - s;
+/* recent direct-solver grids, kept per source, in at most
+ * DEFAULT_GRID_CACHE_MB between them */
+const size_t DEFAULT_GRID_CACHE = 4;
+const size_t DEFAULT_GRID_CACHE_MB = 1024;
+const size_t MB = 1 << 20;
+GridCache grid_cache(DEFAULT_GRID_CACHE, DEFAULT_GRID_CACHE_MB * MB);
 
-    scalar r2 = r.magnitudeSquared();
+/* points watched by `probes', kept as basis fields like the grids */
+FieldType probe_type;
+vector<vec3> probe_points;
+BasisField probe_field;
 
-    vec3 rnorm = r / std::sqrt(r2);
+/* time per phase while profiling; the units are points evaluated for
+ * integration and bytes for formatting */
+ProfileCounter prof_integration, prof_formatting, prof_gnuplot;
 
-    return ds.cross(rnorm) / r2;
-}
+/* when `profile on' last started and `profile off' last stopped */
+uint64_t profile_started = 0, profile_stopped = 0;
 
-/* dl * r / (|r| ^ 2) */
-vec3 dE(vec3 s, vec3 ds)
-{
-    vec3 r = point - s;
+/* the operation Ctrl-C cancels, if one is running */
+atomic<Progress*> current_op{NULL};
 
-    scalar r2 = r.magnitudeSquared();
+/* A long part of the current command.  While it runs, Ctrl-C cancels
+ * it instead of leaving fieldviz, and on a terminal its progress and
+ * the time left are shown every second. */
+class Operation : public Progress {
+public:
+    explicit Operation(const char *what, size_t total = 0) : Progress(total), what(what)
+    {
+        if(isatty(STDERR_FILENO))
+            reporter = [this](const Progress &) { report(); };
 
-    vec3 rnorm = r / std::sqrt(r2);
+        current_op = this;
+    }
 
-    return rnorm * ds.magnitude() / r2;
-}
+    ~Operation()
+    {
+        current_op = NULL;
+
+        if(reported)
+            cerr << endl;
+    }
+
+    /* give up on the command if Ctrl-C was pressed */
+    void check() const
+    {
+        if(cancelled())
+            throw "interrupted";
+    }
+
+private:
+    const char *what;
+    atomic<bool> reported{false};
+
+    void report()
+    {
+        double left = eta();
+
+        cerr << "\r" << what << ": ";
+        if(total())
+            cerr << (int)(100.0 * done() / total()) << "% (" << done() << " of " << total() << "), ";
+        cerr << (int)elapsed() << " s";
+        if(left >= 0)
+            cerr << ", about " << (int)ceil(left) << " s left";
+        cerr << "   " << flush;
+
+        reported = true;
+    }
+};
 
-int ent_counter = 0;
-map<int, Entity> entities;
+/* where the trace being recorded will be written */
+string trace_path;
 
-int add_entity(Entity e)
+/* write out the trace being recorded, if any */
+void finish_trace()
 {
-    entities[ent_counter] = e;
-    return ent_counter++;
+    if(trace_path.empty())
+        return;
+
+    long n = trace_stop(trace_path);
+    if(n < 0)
+        cerr << trace_path << ": cannot write trace" << endl;
+    else
+        cout << "Wrote " << n << " spans to " << trace_path << endl;
+
+    trace_path.clear();
 }
 
-int add_current(scalar I, Manifold *path)
+/* drop every cached basis field, e.g. when the discretization changes */
+void clear_basis_fields()
 {
-    return add_entity((Entity){ Entity::CURRENT, I, path });
+    grid_cache.clear();
+    probe_field = BasisField(probe_points.size());
 }
 
-int add_charge(scalar Q_density, Manifold *path)
+/* summarize adaptive quadrature work over `points' queries */
+void report_quad_stats(size_t points)
 {
-    return add_entity((Entity){ Entity::CHARGE, Q_density, path });
-}
+    if(scene.quadrature() != QUAD_ADAPTIVE || scene.solver() != SOLVER_DIRECT)
+        return;
 
-const scalar U0 = 4e-7 * M_PI;
-const scalar C = 299792458;
-const scalar E0 = 1 / ( U0 * C * C );
-const scalar K_E = 1 / (4 * M_PI * E0);
-const scalar DEFAULT_D = 1e-1;
-scalar D = DEFAULT_D;
+    cout << "Adaptive quadrature: " << scene.quad_evaluations() << " integrand evaluations";
+    if(points > 1)
+        cout << " (" << (double)scene.quad_evaluations() / points << " per point)";
+    cout << endl;
 
-vec3 calc_Bfield(vec3 x)
-{
-    point = x;
+    if(scene.quad_unconverged())
+        cerr << "warning: " << scene.quad_unconverged() << " integral(s) hit the evaluation cap before reaching tolerance" << endl;
+}
+
+/* writes each sample to a stream */
+struct SampleWriter {
+    TextWriter &out;
 
-    vec3 B = 0;
+    SampleWriter(TextWriter &out) : out(out) {}
 
-    for(map<int, Entity>::iterator i = entities.begin(); i != entities.end(); i++)
+    void operator()(vec3 s, vec3 ds, scalar)
     {
-        Entity &e = i->second;
-        if(e.type == Entity::CURRENT)
-            B += e.path->integrate(dB, D) * U0 * e.I;
+        out.line(s, ds);
     }
+};
 
-    return B;
+void dump_points(TextWriter &out, const SampleSet &samples)
+{
+    SampleWriter w(out);
+    samples.for_each(w);
 }
 
-vec3 calc_Efield(vec3 x)
+int dump_entities(ostream &os, int which, const map<int, Entity> &en)
 {
-    point = x;
+    ProfileScope prof(prof_formatting);
+    TraceSpan span("output", "write");
+    TextWriter out(os);
 
-    vec3 E = 0;
+    Operation op("draw", en.size());
 
-    for(map<int, Entity>::iterator i = entities.begin(); i != entities.end(); i++)
+    int count = 0;
+    for(map<int, Entity>::const_iterator i = en.begin(); i != en.end(); i++)
     {
-        Entity &e = i->second;
-        if(e.type == Entity::CHARGE)
-            E += e.path->integrate(dE, D) * K_E * e.Q_density;
+        op.check();
+        op.advance(1);
+
+        const Entity &e = i->second;
+        if(which & e.type)
+        {
+            dump_points(out, e.samples);
+
+            /* two blank lines mark an index in gnuplot */
+            out.newline();
+            out.newline();
+
+            count++;
+        }
     }
 
-    return E;
+    out.flush();
+    prof.units = out.bytes();
+
+    return count;
 }
 
-ostream *dump_ofs = NULL;
+ThreadPool *pool = NULL;
 
-vec3 dump(vec3 s, vec3 ds)
+/* (re)create the worker pool; 0 means one thread per core */
+void set_threads(unsigned n)
 {
-    *dump_ofs << s << " " << ds << endl;
+    if(!n)
+        n = thread::hardware_concurrency();
 
-    return 0;
+    delete pool;
+    pool = new ThreadPool(n);
 }
 
-void dump_points(ostream &out, Manifold *c)
+/* field line tracing, relative to the size of the bounding box */
+const scalar FIELDLINE_TOL = 1e-5;
+const scalar FIELDLINE_MAX_STEP = 5e-3;
+const scalar FIELDLINE_MAX_LENGTH = 20;
+const scalar FIELDLINE_CLOSE_DIST = 1e-3;
+const size_t FIELDLINE_MAX_STEPS = 100000;
+const size_t FIELDLINE_MAX_REJECTS = 10000;
+
+/* Compare FMM results against the direct sum at a spread of points.
+ * Errors are relative to the largest field among those points, since
+ * the field can vanish at some of them (on a symmetry plane, say);
+ * points on a source, where the field is singular, are left out. */
+void report_fmm_error(enum FieldType type, const vector<vec3> &pts, const vector<vec3> &field)
 {
-    dump_ofs = &out;
-    c->integrate(dump, D);
+    size_t n = pts.size();
+    size_t stride = max((size_t)1, n / FMM_CHECK_POINTS);
+    size_t checks = (n + stride - 1) / stride;
+
+    vector<scalar> err(checks), mag(checks);
+
+    pool->parallel_for(checks, [&](size_t c) {
+            size_t i = c * stride;
+            vec3 exact = scene.direct_field(type, pts[i]);
+            err[c] = (field[i] - exact).magnitude();
+            mag[c] = exact.magnitude();
+        });
+
+    scalar max_err = 0, sum_sq = 0, scale = 0;
+    size_t used = 0;
+    for(size_t c = 0; c < checks; c++)
+    {
+        if(!isfinite(err[c]) || !isfinite(mag[c]))
+            continue;
+
+        used++;
+        max_err = max(max_err, err[c]);
+        sum_sq += err[c] * err[c];
+        scale = max(scale, mag[c]);
+    }
+
+    /* no field at all: report absolute errors, which should be 0 */
+    if(scale == 0)
+        scale = 1;
+
+    cout << "FMM order " << scene.fmm_order() << ": max relative error " << max_err / scale
+         << ", rms " << (used ? sqrt(sum_sq / used) : 0) / scale
+         << " over " << used << " directly summed points" << endl;
 }
 
-int dump_entities(ostream &out, int which, map<int, Entity> &en)
+/* the coordinates visited by `for(c = lo; c <= hi; c += delta)';
+ * delta must be positive */
+vector<scalar> grid_axis(scalar lo, scalar hi, scalar delta)
 {
-    int count = 0;
-    for(map<int, Entity>::iterator i = en.begin(); i != en.end(); i++)
+    vector<scalar> axis;
+    for(scalar c = lo; c <= hi; c += delta)
+        axis.push_back(c);
+    return axis;
+}
+
+/* Field vectors over a region of space, scaled for plotting, with x
+ * varying fastest, then y, then z */
+struct FieldGrid {
+    FieldType type;
+    vec3 lower, upper;
+    scalar delta;
+
+    vector<scalar> xs, ys, zs;
+    vector<vec3> field;
+
+    FieldGrid(FieldType type, vec3 lower, vec3 upper, scalar delta) :
+        type(type), lower(lower), upper(upper), delta(delta),
+        xs(grid_axis(lower[0], upper[0], delta)),
+        ys(grid_axis(lower[1], upper[1], delta)),
+        zs(grid_axis(lower[2], upper[2], delta))
     {
-        Entity &e = i->second;
-        if(which & e.type)
-        {
-            dump_points(out, e.path);
+        field.resize(size());
+    }
 
-            /* two blank lines mark an index in gnuplot */
-            out << endl << endl;
+    size_t size() const { return xs.size() * ys.size() * zs.size(); }
 
-            count++;
-        }
+    vec3 point(size_t i) const
+    {
+        return vec3(xs[i % xs.size()],
+                    ys[i / xs.size() % ys.size()],
+                    zs[i / (xs.size() * ys.size())]);
     }
 
-    return count;
+    vector<vec3> points() const
+    {
+        vector<vec3> pts(size());
+        for(size_t i = 0; i < pts.size(); i++)
+            pts[i] = point(i);
+        return pts;
+    }
+
+    /* unit vectors a tenth long */
+    void normalize()
+    {
+        for(vec3 &f : field)
+            f = f.normalize() / 10;
+    }
+};
+
+/* evaluate a grid's field with the current scene, reusing cached
+ * basis fields under the direct solver */
+void compute_field(FieldGrid &grid)
+{
+    scene.reset_stats();
+
+    size_t n = grid.size();
+    FieldType type = grid.type;
+
+    ProfileScope integrating(prof_integration);
+    integrating.units = n;
+
+    Operation op("field");
+
+    GridKey key = { (int)type, grid.lower, grid.upper, grid.delta };
+
+    /* one basis field per source, plus their sum */
+    size_t sources = 0;
+    for(auto &e : scene.entities())
+        if(e.second.type == (type == FieldType::E ? Entity::CHARGE : Entity::CURRENT))
+            sources++;
+    size_t need = (sources + 1) * n * sizeof(vec3);
+
+    bool cacheable = scene.solver() == SOLVER_DIRECT && grid_cache.capacity()
+        && need <= grid_cache.byte_limit();
+
+    /* a grid that has outgrown the cache is dropped rather than kept
+     * stale */
+    if(!cacheable)
+        grid_cache.erase(key);
+
+    if(cacheable)
+    {
+        GridCache::Grid *cached = grid_cache.find(key);
+        bool hit = cached != NULL;
+        if(!hit)
+            cached = &grid_cache.insert(key, n);
+        grid_cache.make_room(need);
+
+        size_t computed = scene.update_basis(*cached, type,
+                                             [&](size_t i) { return grid.point(i); },
+                                             *pool, &op);
+
+        /* the sources finished stay cached, so running it again
+         * carries on from there */
+        if(op.cancelled())
+            cout << "Interrupted; " << computed << " more source(s) computed and cached." << endl;
+        op.check();
+
+        grid.field = cached->total;
+
+        if(hit)
+            cout << "Grid cache: reused " << cached->ids().size() - computed << " source(s), computed " << computed << endl;
+    }
+    else
+    {
+        vector<vec3> pts = grid.points();
+
+        scene.field(type, pts, grid.field, *pool, &op);
+        op.check();
+
+        if(scene.solver() == SOLVER_FMM)
+            report_fmm_error(type, pts, grid.field);
+    }
+
+    grid.normalize();
+
+    integrating.stop();
+
+    report_quad_stats(n);
 }
 
-/* dump the field vectors with a spacing of `delta' */
-/* requires x0 < x1, y0 < y1, z0 < z1 */
+/* write a grid's vectors as text or binary records according to
+ * `output'; returns the number of vectors */
+size_t write_field(ostream &out, const FieldGrid &grid)
+{
+    size_t n = grid.size();
+
+    ProfileScope formatting(prof_formatting);
+    TraceSpan writing("output", "write");
+
+    if(output == OUTPUT_BINARY)
+    {
+        BinaryWriter w(out, binary_format);
+        for(size_t i = 0; i < n; i++)
+            w.line(grid.point(i), grid.field[i]);
+        w.flush();
+        formatting.units = w.bytes();
+    }
+    else
+    {
+        TextWriter w(out);
+        for(size_t i = 0; i < n; i++)
+            w.line(grid.point(i), grid.field[i]);
+        w.flush();
+        formatting.units = w.bytes();
+    }
 
-enum FieldType { E, B };
+    return n;
+}
 
-/* dump field in a region of space to vectors */
-void dump_field(ostream &out,
-                enum FieldType type,
-                vec3 lower_corner, vec3 upper_corner,
-                scalar delta)
+/* Compare libfml's uniform sampling against Gauss-Legendre panels over
+ * a range of D, relative to a tight adaptive reference.  Both solve the
+ * same shapes, except that the quadrature modes follow the documented
+ * toroid pitch, which libfml does not. */
+void print_convergence(enum FieldType type, vec3 x, int n)
 {
-    for(scalar z = lower_corner[2]; z <= upper_corner[2]; z += delta)
-        for(scalar y = lower_corner[1]; y <= upper_corner[1]; y += delta)
-            for(scalar x = lower_corner[0]; x <= upper_corner[0]; x += delta)
-            {
-                vec3 pt(x, y, z);
-                vec3 field = (type == E) ? calc_Efield(pt) : calc_Bfield(pt);
+    vec3 ref;
+    size_t ref_evals = scene.sampled_field(type, x, 0, 0, ref);
 
-                field = field.normalize() / 10;
-                out << pt << " " << field << endl;
-            }
+    cout << "Reference (adaptive, tol 1e-12): " << ref << " (" << ref_evals << " evaluations)" << endl;
+    cout << setw(10) << "D"
+         << setw(16) << "uniform" << setw(12) << "rel. error"
+         << setw(16) << ("gauss " + to_string(n)) << setw(12) << "rel. error" << endl;
+
+    Operation op("convergence", 7);
+
+    for(scalar d = .4; d > .005; d /= 2)
+    {
+        op.check();
+        op.advance(1);
+
+        vec3 fu, fg;
+        size_t nu = scene.sampled_field(type, x, d, 0, fu);
+        size_t ng = scene.sampled_field(type, x, d, n, fg);
+
+        cout << setw(10) << d
+             << setw(16) << nu << setw(12) << setprecision(3) << (fu - ref).magnitude() / ref.magnitude()
+             << setw(16) << ng << setw(12) << (fg - ref).magnitude() / ref.magnitude()
+             << setprecision(6) << endl;
+    }
 }
 
-/* trace a field line */
-void dump_fieldline(ostream &out, vec3 x, scalar len)
+/* Trace field lines both ways from each seed, staying within the box
+ * lower-upper, and write each as one gnuplot index.  Seeds are traced
+ * in parallel; returns the number of lines written. */
+int dump_fieldlines(ostream &out,
+                    enum FieldType type,
+                    vec3 lower, vec3 upper,
+                    const vector<vec3> &seeds)
 {
-    point = x;
-    scalar delta = .1;
-    while(len > 0)
+    scene.reset_stats();
+
+    scalar diag = (upper - lower).magnitude();
+
+    TraceOptions opts;
+    opts.lower = lower;
+    opts.upper = upper;
+    opts.tol = FIELDLINE_TOL * diag;
+    opts.max_step = FIELDLINE_MAX_STEP * diag;
+    opts.max_length = FIELDLINE_MAX_LENGTH * diag;
+    opts.max_steps = FIELDLINE_MAX_STEPS;
+    opts.max_rejects = FIELDLINE_MAX_REJECTS;
+    opts.close_dist = FIELDLINE_CLOSE_DIST * diag;
+
+    Operation op("fieldline", seeds.size());
+    opts.progress = &op;
+
+    function<vec3(vec3)> field = [type](vec3 x) {
+        return scene.field(type, x);
+    };
+
+    size_t n = seeds.size();
+    vector<vector<vec3> > lines(n);
+    vector<TraceEnd> ends(n);
+
+    /* whether each line was traced to the end, rather than cut short
+     * or skipped by Ctrl-C */
+    vector<char> finished(n, 0);
+
+    ProfileScope integrating(prof_integration);
+
+    pool->parallel_for(n, [&](size_t i) {
+            TraceSpan span("field", "fieldline");
+            if(span.active())
+                span.detail = "seed " + to_string(i);
+
+            if(op.cancelled())
+                return;
+
+            vector<vec3> back, fwd;
+            TraceEnd back_end = TRACE_CLOSED;
+
+            ends[i] = trace_fieldline(field, seeds[i], 1, opts, fwd);
+
+            /* a closed line is already complete */
+            if(ends[i] != TRACE_CLOSED)
+                back_end = trace_fieldline(field, seeds[i], -1, opts, back);
+
+            finished[i] = ends[i] != TRACE_CANCELLED && back_end != TRACE_CANCELLED;
+            op.advance(1);
+
+            /* join them through the seed, which both start with */
+            vector<vec3> &line = lines[i];
+            line.assign(back.rbegin(), back.rend());
+            if(!line.empty())
+                line.pop_back();
+            line.insert(line.end(), fwd.begin(), fwd.end());
+        });
+
+    for(vector<vec3> &line : lines)
+        integrating.units += line.size();
+    integrating.stop();
+
+    /* keep the lines finished before Ctrl-C */
+    size_t traced = 0;
+    for(char f : finished)
+        traced += f;
+
+    if(op.cancelled())
+    {
+        cout << "Interrupted; plotting the " << traced << " of " << n << " field lines finished." << endl;
+        if(!traced)
+            op.check();
+    }
+
+    ProfileScope formatting(prof_formatting);
+    TraceSpan writing("output", "write");
+    TextWriter w(out);
+
+    size_t closed = 0, points = 0;
+    for(size_t i = 0; i < n; i++)
     {
-        out << point << endl;
+        if(!finished[i])
+            continue;
 
-        vec3 B = calc_Bfield(point);
+        for(vec3 &x : lines[i])
+        {
+            w.put(x);
+            w.newline();
+        }
+        w.newline();
+        w.newline();
 
-        point += delta * B;
-        len -= delta;
+        closed += ends[i] == TRACE_CLOSED;
+        points += lines[i].size();
     }
+
+    w.flush();
+    formatting.units = w.bytes();
+    formatting.stop();
+
+    cout << "Traced " << traced << " field lines (" << closed << " closed, "
+         << points << " points)" << endl;
+
+    report_quad_stats(points);
+
+    return traced;
 }
 
 /* dump field magnitudes along a line */
 void dump_values(vec3 start, vec3 del, int times)
 {
-    point = start;
+    vec3 x = start;
     while(times--)
     {
-        point += del;
+        x += del;
     }
 }
 
-void all_lower(string &str)
+/* start collecting counters afresh */
+void start_profile()
 {
-    for(int i = 0; i < str.length(); i++)
-        str[i] = tolower(str[i]);
+    scene.reset_profile();
+    prof_integration.reset();
+    prof_formatting.reset();
+    prof_gnuplot.reset();
+
+    profile_started = profile_clock();
+    profile_enabled = true;
 }
 
-string itoa(int n)
+void stop_profile()
 {
-    stringstream ss;
-    ss << n;
-    return ss.str();
+    if(profiling())
+        profile_stopped = profile_clock();
+    profile_enabled = false;
+    hw_enabled = false;
 }
 
-Manifold *parse_curve(stringstream &ss)
+/* one row of the `stats' tables */
+void print_counter(const string &name, const ProfileCounter &c, const char *units)
 {
-    string type;
-    ss >> type;
-    if(type == "line" || type == "linesegment")
-    {
-        vec3 a, b;
-        ss >> a >> b;
-        return (Curve*)new LineSegment(a, b);
-    }
-    else if(type == "arc")
-    {
-        vec3 center, radius, normal;
-        scalar angle;
-        ss >> center >> radius >> normal;
-        ss >> angle;
-        return (Curve*)new Arc(center, radius, normal, angle);
-    }
-    else if(type == "spiral" || type == "solenoid")
-    {
-        vec3 origin, radius, normal;
-        scalar angle, pitch;
-        ss >> origin >> radius >> normal >> angle >> pitch;
-        return (Curve*)new Spiral(origin, radius, normal, angle, pitch);
-    }
-    else if(type == "toroid")
-    {
-        vec3 origin, maj_radius, maj_normal;
-        scalar min_radius, maj_angle, pitch;
-        ss >> origin >> maj_radius >> maj_normal;
-        ss >> min_radius >> maj_angle >> pitch;
+    cout << setw(14) << name << setw(10) << c.calls << setw(12) << c.seconds()
+         << setw(14) << c.units;
+    if(*units)
+        cout << " " << units;
+    cout << endl;
+}
 
-        return (Curve*)new Toroid(origin, maj_radius, maj_normal, maj_angle, min_radius, pitch);
-    }
-    else if(type == "plane")
+/* what the counters collected since `profile on' */
+void print_stats()
+{
+    if(!profile_started)
     {
-        vec3 origin, v1, v2;
-        ss >> origin >> v1 >> v2;
-        return (Surface*)new Plane(origin, v1, v2);
+        cout << "No profile collected yet; `profile on' starts one." << endl;
+        return;
     }
-    else if(type == "disk")
+
+    uint64_t end = profiling() ? profile_clock() : profile_stopped;
+    cout << "Profile over " << (end - profile_started) * 1e-9 << " s"
+         << (profiling() ? " (running)" : "") << endl;
+
+    cout << setprecision(4);
+
+    cout << setw(14) << "phase" << setw(10) << "calls" << setw(12) << "seconds" << setw(14) << "work" << endl;
+    print_counter("integration", prof_integration, "points");
+    print_counter("formatting", prof_formatting, "bytes");
+    print_counter("gnuplot", prof_gnuplot, "");
+    if(prof_formatting.ns)
+        cout << "Formatted " << prof_formatting.units / prof_formatting.seconds() / 1e6 << " MB/s" << endl;
+
+    /* summed over threads, so these can exceed the wall time */
+    cout << endl << "Thread-seconds per source (direct solver):" << endl;
+    cout << setw(14) << "ID" << setw(10) << "points" << setw(12) << "seconds" << setw(14) << "kernel evals"
+         << setw(12) << "ns/eval" << "  shape" << endl;
+
+    for(auto &i : scene.entities())
     {
-        vec3 center, radius, normal;
-        scalar angle;
-        ss >> center >> radius >> normal >> angle;
-        return (Surface*)new Disk(center, radius, normal, angle);
+        const ProfileCounter &c = *i.second.profile;
+        cout << setw(14) << i.first << setw(10) << c.calls << setw(12) << c.seconds()
+             << setw(14) << c.units << setw(12) << (c.units ? (double)c.ns / c.units : 0)
+             << "  " << (i.second.type == Entity::CURRENT ? "I " : "Q ") << i.second.path->name() << endl;
     }
-    else if(type == "sphere")
-    {
-        vec3 center;
-        scalar radius;
-        ss >> center >> radius;
 
-        return (Surface*)new Sphere(center, radius);
-    }
-    else if(type == "opencylinder")
+    bool any_hw = false;
+    for(auto &i : scene.entities())
+        any_hw |= !i.second.profile->hw.empty();
+
+    if(any_hw)
     {
-        vec3 origin, axis;
-        scalar rad;
-        ss >> origin >> axis >> rad;
-        return (Surface*)new OpenCylinder(origin, axis, rad);
+        cout << endl << "CPU counters per kernel evaluation:" << endl;
+        cout << setw(14) << "ID" << setw(10) << "cycles" << setw(12) << "IPC"
+             << setw(14) << "cache misses" << setw(12) << "br. misses" << endl;
+
+        for(auto &i : scene.entities())
+        {
+            const ProfileCounter &c = *i.second.profile;
+            if(c.hw.empty() || !c.units)
+                continue;
+
+            double evals = c.units;
+            cout << setw(14) << i.first << setw(10) << c.hw.v[HW_CYCLES] / evals
+                 << setw(12) << c.hw.ipc()
+                 << setw(14) << c.hw.v[HW_CACHE_MISSES] / evals
+                 << setw(12) << c.hw.v[HW_BRANCH_MISSES] / evals << endl;
+        }
     }
-    else if(type == "closedcylinder")
+
+    const ProfileCounter &solver = scene.solver_profile();
+    if(solver.calls)
     {
-        vec3 origin, axis;
-        scalar rad;
-        ss >> origin >> axis >> rad;
-        return (Surface*)new ClosedCylinder(origin, axis, rad);
+        cout << endl << "Tree and FMM solvers:" << endl;
+        print_counter("solver", solver, "points");
     }
-    else throw "unknown curve type (must be line, arc, spiral, or toroid)";
+
+    cout << setprecision(6);
+}
+
+void all_lower(string &str)
+{
+    for(int i = 0; i < str.length(); i++)
+        str[i] = tolower(str[i]);
+}
+
+string itoa(int n)
+{
+    stringstream ss;
+    ss << n;
+    return ss.str();
 }
 
 void print_help()
@@ -309,206 +717,1212 @@ void print_help()
     cout << "  delete [ID..]" << endl;
     cout << "    Delete an entity by its previously returned identifier." << endl;
     cout << endl;
+    cout << "  set ID {I CURRENT|Q DENSITY}" << endl;
+    cout << "    Change the current or charge density of an entity" << endl;
+    cout << endl;
     cout << "  draw [I|Q] ..." << endl;
     cout << "    Draw the specified current/charge distributions" << endl;
     cout << endl;
-    cout << "  field [E|B] <lower_corner> <upper_corner> DELTA" << endl;
+    cout << "  field [E|B] <lower_corner> <upper_corner> DELTA [&]" << endl;
     cout << "    Plot the E or B field in the rectangular prism bounded by lower and upper." << endl;
-    cout << "    DELTA specifies density." << endl;
+    cout << "    DELTA specifies density.  With &, evaluate in the background and plot when done." << endl;
+    cout << endl;
+    cout << "  jobs" << endl;
+    cout << "  wait [ID]" << endl;
+    cout << "  cancel ID" << endl;
+    cout << "    List background jobs, wait for one (or all) to finish, or stop one" << endl;
+    cout << endl;
+    cout << "  fieldline [E|B] <lower_corner> <upper_corner> <seed> [<seed>..]" << endl;
+    cout << "  fieldline [E|B] <lower_corner> <upper_corner> grid <from> <to> DELTA" << endl;
+    cout << "    Trace E or B field lines through each seed (or a grid of seeds) until they" << endl;
+    cout << "    close on themselves or leave the box bounded by lower and upper." << endl;
     cout << endl;
     cout << "  newwindow" << endl;
     cout << "    Make future plots go into a new window" << endl;
     cout << endl;
     cout << "  delta D" << endl;
     cout << "    Set integration fineness to D (smaller is better but slower)" << endl;
-}
-
-vec3 dA(vec3 s, vec3 dA)
-{
-    /* will cast to vec3 */
-    return dA.magnitude();
+    cout << endl;
+    cout << "  threads N" << endl;
+    cout << "    Evaluate fields with N threads (0 = one per core)" << endl;
+    cout << endl;
+    cout << "  probe [E|B] <point>" << endl;
+    cout << "    Print the E or B field at a single point" << endl;
+    cout << endl;
+    cout << "  probes [E|B <point> [<point>..]]" << endl;
+    cout << "    Watch the E or B field at a set of points, and print it" << endl;
+    cout << endl;
+    cout << "  solver [direct|tree|fmm]" << endl;
+    cout << "    Sum over every source sample, approximate distant ones with an octree," << endl;
+    cout << "    or evaluate whole field grids with the fast multipole method" << endl;
+    cout << endl;
+    cout << "  accuracy THETA" << endl;
+    cout << "    Set the tree solver's opening angle (smaller is more accurate but slower)" << endl;
+    cout << endl;
+    cout << "  order P" << endl;
+    cout << "    Set the FMM expansion order (larger is more accurate but slower)" << endl;
+    cout << endl;
+    cout << "  quadrature [uniform|adaptive]" << endl;
+    cout << "    Integrate sources with libfml's fixed step D, or adaptively to a tolerance" << endl;
+    cout << endl;
+    cout << "  quadrature gauss N" << endl;
+    cout << "    Discretize sources with N Gauss-Legendre nodes per panel of length N * D" << endl;
+    cout << endl;
+    cout << "  convergence [E|B] <point> [N]" << endl;
+    cout << "    Tabulate the error of uniform and N-point Gauss sampling against D" << endl;
+    cout << endl;
+    cout << "  tol REL [ABS]" << endl;
+    cout << "    Set the relative (and absolute) tolerance and switch to adaptive quadrature" << endl;
+    cout << endl;
+    cout << "  analytic [on|off]" << endl;
+    cout << "    Use exact closed forms for line segments and full circular loops" << endl;
+    cout << endl;
+    cout << "  output [text|binary [float32|float64]]" << endl;
+    cout << "    Hand field grids to gnuplot as text or as binary records" << endl;
+    cout << endl;
+    cout << "  cache [N [MB]]" << endl;
+    cout << "    Keep the last N field grids per source, in at most MB megabytes, so add and" << endl;
+    cout << "    delete only redo one source; larger grids are not cached" << endl;
+    cout << endl;
+    cout << "  transport [pipe|tmpfile]" << endl;
+    cout << "    Send plot data inline through the gnuplot pipe, or through temporary files" << endl;
+    cout << endl;
+    cout << "  kernel [auto|scalar|avx2|avx512]" << endl;
+    cout << "    Select (or show) the instruction set used by the field kernels" << endl;
+    cout << endl;
+    cout << "  profile [on|hw|off]" << endl;
+    cout << "    Start (clearing the counters) or stop collecting timings and work counts;" << endl;
+    cout << "    hw also samples CPU cycles, instructions, cache and branch misses" << endl;
+    cout << endl;
+    cout << "  stats" << endl;
+    cout << "    Show the time and work per phase and per source since `profile on'" << endl;
+    cout << endl;
+    cout << "  trace [FILE|off]" << endl;
+    cout << "    Record a timeline of commands, field tiles, output and plotting to FILE" << endl;
+    cout << "    (Chrome trace format), written when stopped or on exit" << endl;
 }
 
 string hist_path;
 
-void exit_handler()
-{
-    write_history(hist_path.c_str());
-}
+/* started by gnuplot() on the first plot */
+Gnuplot *gp = NULL;
 
-void int_handler(int a)
+Gnuplot &gnuplot()
 {
-    (void) a;
-    exit(0);
-}
+    if(!gp)
+    {
+        try {
+            Gnuplot::set_terminal_std("qt");
+            gp = new Gnuplot();
+        }
+        catch(GnuplotException e) {
+            Gnuplot::set_terminal_std("dumb");
+            gp = new Gnuplot();
+        }
 
-int main(int argc, char *argv[])
-{
-    Surface *surf = new Sphere(vec3(0, 0, 1), 1);
-    cout << "Area of 10x10 square = " << surf->integrate(dA, D) << endl;
+        *gp << "set view equal xyz";
+    }
 
-    hist_path = getenv("HOME");
-    hist_path += "/";
-    hist_path += HISTORY_FILE;
+    return *gp;
+}
 
-    using_history();
-    read_history(hist_path.c_str());
-    atexit(exit_handler);
-    signal(SIGINT, int_handler);
+/* how plot data reaches gnuplot */
+enum Transport { TRANSPORT_PIPE, TRANSPORT_TMPFILE };
+Transport transport = TRANSPORT_PIPE;
 
-    Gnuplot *gp = NULL;
+/* datablocks sent since the last splot; each plot gets its own so
+ * replot still works, and a new splot frees them */
+int datablocks = 0;
 
-    try {
-        Gnuplot::set_terminal_std("qt");
-        gp = new Gnuplot();
-    }
-    catch(GnuplotException e) {
-        Gnuplot::set_terminal_std("dumb");
-        gp = new Gnuplot();
-    }
+/* will change to replot on subsequent commands */
+string plot_cmd = "splot";
 
-    *gp << "set view equal xyz";
+/* in batch mode, the directory plot data is written to instead */
+bool batch = false;
+string batch_dir;
+int batch_files = 0;
 
-    cout << "Welcome to fieldviz!" << endl << endl;
-    cout << "Type `help' for a command listing." << endl;
+/* Hand the data produced by write() to gnuplot, and return how a plot
+ * command refers to it.  Text goes down the pipe as an inline datablock
+ * (gnuplot 5); binary data, which a datablock cannot hold and which
+ * '-' could not replot, always goes through a tmpfile.  In batch mode
+ * it is saved as the next numbered file named after `what'. */
+string deliver_plot_data(const char *what, bool binary, const function<void(ostream&)> &write)
+{
+    if(batch)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%03d-%s.%s", ++batch_files, what, binary ? "bin" : "dat");
 
-    /* will change to replot on subsequent commands */
-    string plot_cmd = "splot";
+        string fname = batch_dir + name;
+        ofstream out(fname, binary ? ios::binary : ios::out);
+        if(!out)
+            throw "cannot create output file";
 
-    while(1)
-    {
-        char *cs = readline("fieldviz> ");
-        if(!cs)
-            return 0;
-        add_history(cs);
+        try {
+            write(out);
+        } catch(...) {
+            out.close();
+            remove(fname.c_str());
+            batch_files--;
+            throw;
+        }
 
-        string line(cs);
+        out.close();
+        if(!out)
+            throw "cannot write output file";
 
-        free(cs);
+        cout << "Wrote " << fname << endl;
+        return fname;
+    }
 
-        all_lower(line);
+    if(transport == TRANSPORT_PIPE && !binary)
+    {
+        Gnuplot &g = gnuplot();
 
-        /* parse */
-        stringstream ss(line);
+        /* this data starts a new window, which nothing earlier is
+         * replotted in */
+        if(plot_cmd == "splot" && datablocks)
+        {
+            g << "undefine $fv*";
+            datablocks = 0;
+        }
 
-        string cmd;
-        ss >> cmd;
+        string name = "$fv" + to_string(datablocks++);
+        g << name + " << EOD";
 
+        /* end the datablock even if write() gives up */
         try {
-            if(cmd == "add")
-            {
-                /* add a current or charge distribution */
-                Entity e;
+            write(g.data());
+        } catch(...) {
+            g.data().flush();
+            g << "EOD";
+            throw;
+        }
 
-                string type;
-                ss >> type;
+        g.data().flush();
+        g << "EOD";
 
-                /* union */
-                double val;
-                ss >> val;
+        return name;
+    }
 
-                Manifold *path = parse_curve(ss);
+    ofstream out;
+    string fname = gnuplot().create_tmpfile(out);
+    write(out);
+    out.close();
 
-                cout << "Manifold type: " << path->name() << endl;
+    return "'" + fname + "'";
+}
 
-                int idx;
-                if(type == "i")
-                    idx = add_current(val, path);
-                else if(type == "q")
-                    idx = add_charge(val, path);
-                else throw "unknown distribution type (must be I or Q)";
+/* deliver_plot_data(), with the time not spent in write() itself (which
+ * accounts for its own phases) counted as gnuplot handoff */
+string send_plot_data(const char *what, bool binary, const function<void(ostream&)> &write)
+{
+    TraceSpan span("gnuplot", "send data");
+    if(span.active())
+        span.detail = what;
 
-                cout << "Index: " << idx << endl;
-            }
-            else if(cmd == "delete")
-            {
-                int id;
-                while(ss >> id)
-                {
-                    if(entities.erase(id))
-                        cout << "Deleted " << id << "." << endl;
-                    else
-                        cerr << "No entity " << id << "!" << endl;
-                }
-            }
-            else if(cmd == "field")
-            {
-                string type;
+    if(!profiling())
+        return deliver_plot_data(what, binary, write);
 
-                vec3 lower, upper;
-                scalar delta;
+    uint64_t start = profile_clock(), writing = 0;
 
-                if(!(ss >> type >> lower >> upper >> delta))
-                    throw "plot requires <E/B> <lower> <upper> delta";
+    string ref = deliver_plot_data(what, binary, [&](ostream &out) {
+            uint64_t t = profile_clock();
+            write(out);
+            writing += profile_clock() - t;
+        });
 
-                FieldType t = (type == "e") ? FieldType::E : FieldType::B;
+    prof_gnuplot.add(0, profile_clock() - start - writing);
 
-                ofstream out;
-                string fname = gp->create_tmpfile(out);
+    return ref;
+}
 
-                dump_field(out,
-                           t,
-                           lower, upper, delta);
+/* plot (or, with the first plot in a window, splot) something */
+void plot(const string &what)
+{
+    if(batch)
+        return;
 
-                out.close();
+    ProfileScope prof(prof_gnuplot);
+    TraceSpan span("gnuplot", "plot");
+    gnuplot() << plot_cmd + " " + what;
+    plot_cmd = "replot";
+}
 
-                string cmd = plot_cmd + " '" + fname + "' w vectors";
-                *gp << cmd;
+void plot_field(const FieldGrid &grid)
+{
+    size_t n = 0;
+    string data = send_plot_data("field", output == OUTPUT_BINARY, [&](ostream &out) {
+            n = write_field(out, grid);
+        });
 
-                plot_cmd = "replot";
-            }
-            else if(cmd == "draw")
-            {
-                int e_types = 0;
+    if(output == OUTPUT_BINARY)
+        data += " " + gnuplot_binary_spec(binary_format, n, 6) + " using 1:2:3:4:5:6";
 
-                while(ss)
-                {
-                    string type_str;
-                    if(ss >> type_str)
-                    {
-                        if(type_str == "i")
-                            e_types |= Entity::CURRENT;
-                        else if(type_str == "q")
-                            e_types |= Entity::CHARGE;
-                        else
-                            throw "unknown entity type (must be I or Q)";
-                    }
-                }
+    plot(data + " w vectors");
+}
+
+/* A `field ... &', evaluated on threads of its own against a snapshot
+ * of the scene taken when it started */
+struct Job {
+    int id;
+    string command;
+    shared_ptr<const Scene> snapshot;
+    FieldGrid grid;
+
+    Progress progress;
+    const char *error = NULL;
+    atomic<bool> finished{false};
+    thread worker;
+
+    Job(int id, const string &command, const FieldGrid &grid) :
+        id(id), command(command), snapshot(scene.snapshot()), grid(grid) {}
+
+    void run(unsigned threads)
+    {
+        try {
+            ThreadPool workers(threads);
+            snapshot->field(grid.type, grid.points(), grid.field, workers, &progress);
+            grid.normalize();
+        } catch(const char *err) {
+            error = err;
+        } catch(const std::exception &e) {
+            error = "out of memory or threads";
+        }
+
+        finished = true;
+    }
+};
+
+map<int, unique_ptr<Job> > jobs;
+int job_counter = 1;
+
+void start_job(const string &command, const FieldGrid &grid)
+{
+    Job *job = new Job(job_counter++, command, grid);
+    jobs[job->id].reset(job);
+
+    job->worker = thread(&Job::run, job, pool->size());
+
+    cout << "[" << job->id << "] " << job->grid.size() << " points in the background" << endl;
+}
+
+bool jobs_finished()
+{
+    for(auto &j : jobs)
+        if(j.second->finished)
+            return true;
+    return false;
+}
+
+/* report (and plot) every job that has finished, or only job `only'
+ * if it is not 0, in ID order; returns how many of them failed */
+int collect_jobs(int only = 0)
+{
+    int failed = 0;
+
+    for(map<int, unique_ptr<Job> >::iterator i = jobs.begin(); i != jobs.end();)
+    {
+        Job &job = *i->second;
+        if(!job.finished || (only && job.id != only))
+        {
+            i++;
+            continue;
+        }
+
+        job.worker.join();
+
+        cout << "[" << job.id << "] ";
+        if(job.error)
+            cout << "failed (" << job.error << "): ";
+        else if(job.progress.cancelled())
+            cout << "cancelled: ";
+        else
+            cout << "done in " << setprecision(3) << job.progress.elapsed() << setprecision(6) << " s: ";
+        cout << job.command << endl;
+
+        if(job.error)
+            failed++;
+
+        try {
+            if(!job.error && !job.progress.cancelled())
+                plot_field(job.grid);
+        } catch(const char *err) {
+            cerr << "[" << job.id << "] " << err << endl;
+            failed++;
+        } catch(const GnuplotException &e) {
+            cerr << "gnuplot: " << e.what() << endl;
+            failed++;
+        }
+
+        i = jobs.erase(i);
+    }
+
+    return failed;
+}
+
+/* Wait for one job (or all, if id is 0) to finish and collect it,
+ * along with any others that have finished; returns how many of those
+ * failed.  In batch mode only the jobs waited for are collected, so
+ * that output files are numbered the same however quickly the others
+ * ran.  Ctrl-C stops waiting, but not the job. */
+int wait_jobs(int id)
+{
+    Operation op("wait");
+
+    for(auto &j : jobs)
+    {
+        if(id && j.first != id)
+            continue;
+
+        while(!j.second->finished)
+        {
+            op.check();
+            this_thread::sleep_for(chrono::milliseconds(20));
+        }
+    }
+
+    return collect_jobs(batch ? id : 0);
+}
+
+/* stop every job without plotting it, on the way out */
+void abandon_jobs()
+{
+    for(auto &j : jobs)
+        j.second->progress.cancel();
+    for(auto &j : jobs)
+        j.second->worker.join();
+    jobs.clear();
+}
+
+/* set while readline waits for a line, and by Ctrl-C pressed then */
+volatile sig_atomic_t at_prompt = 0, prompt_interrupted = 0;
+
+/* called by readline when a signal interrupts its read: Ctrl-C at the
+ * prompt discards the line being typed */
+int prompt_signal()
+{
+    if(prompt_interrupted)
+    {
+        prompt_interrupted = 0;
+
+        cout << endl;
+        rl_on_new_line();
+        rl_replace_line("", 0);
+        rl_redisplay();
+    }
+
+    return 0;
+}
+
+/* called by readline while it waits for input; with this hook set,
+ * readline polls instead of calling prompt_signal */
+int poll_jobs()
+{
+    prompt_signal();
+
+    if(jobs_finished())
+    {
+        cout << endl;
+        collect_jobs();
+        rl_on_new_line();
+        rl_redisplay();
+    }
+
+    return 0;
+}
+
+void exit_handler()
+{
+    write_history(hist_path.c_str());
+    abandon_jobs();
+    finish_trace();
+
+    /* closes gnuplot and removes its tmpfiles */
+    delete gp;
+    gp = NULL;
+}
+
+/* Ctrl-C cancels the running operation, and leaves fieldviz only if
+ * pressed again before that has stopped; at the prompt it only flags
+ * the line being typed for prompt_signal to discard, and during a
+ * command without an operation it leaves at once.  Leaving is by the
+ * default action of the signal: exit() would run exit_handler and the
+ * destructors of the scene and caches while the cancelled command's
+ * threads still use them. */
+void int_handler(int a)
+{
+    Progress *op = current_op;
+    if(op && !op->cancelled())
+    {
+        op->cancel();
+        return;
+    }
+
+    if(!op && at_prompt)
+    {
+        prompt_interrupted = 1;
+        return;
+    }
+
+    signal(a, SIG_DFL);
+    raise(a);
+}
+
+/* Parse and run one command line.  Errors are thrown as strings;
+ * returns false if the command is unknown. */
+bool run_command(string line)
+{
+    string raw_line = line;
+    all_lower(line);
+
+    /* parse */
+    stringstream ss(line);
+
+    string cmd;
+    ss >> cmd;
+
+    if(cmd.empty() || cmd[0] == '#')
+        return true;
+
+    /* a trailing `&' runs the command in the background */
+    bool background = false;
+    size_t last = line.find_last_not_of(" \t");
+    if(line[last] == '&')
+    {
+        if(cmd != "field")
+            throw "only field can run in the background";
+
+        background = true;
+        line.erase(last);
+        line.erase(line.find_last_not_of(" \t") + 1);
+        ss.str(line);
+        ss.clear();
+        ss >> cmd;
+    }
+
+    TraceSpan span("command", "command");
+    if(span.active())
+        span.detail = line;
+
+    if(cmd == "add")
+    {
+        /* add a current or charge distribution */
+        Entity e;
+
+        string type;
+        ss >> type;
+
+        /* union */
+        double val;
+        ss >> val;
+
+        Shape shape;
+        shared_ptr<Manifold> path;
+        {
+            TraceSpan span("command", "parse");
+            path = parse_curve(ss, shape);
+        }
+
+        cout << "Manifold type: " << path->name() << endl;
+
+        int idx;
+        if(type == "i")
+            idx = scene.add_current(val, path, shape);
+        else if(type == "q")
+            idx = scene.add_charge(val, path, shape);
+        else throw "unknown distribution type (must be I or Q)";
+
+        cout << "Index: " << idx << endl;
+    }
+    else if(cmd == "delete")
+    {
+        /* errors are thrown as C strings, so the message has to
+         * outlive this call */
+        static string missing;
+        missing.clear();
+
+        int id;
+        while(ss >> id)
+        {
+            if(scene.remove(id))
+            {
+                grid_cache.remove_entity(id);
+                cout << "Deleted " << id << "." << endl;
+            }
+            else
+                missing += (missing.empty() ? "no such entity: " : ", ") + itoa(id);
+        }
+
+        if(!missing.empty())
+            throw missing.c_str();
+    }
+    else if(cmd == "set")
+    {
+        int id;
+        string what;
+        scalar val;
+
+        if(!(ss >> id >> what >> val))
+            throw "set requires ID {I|Q} VALUE";
+
+        if(what != "i" && what != "q")
+            throw "unknown distribution type (must be I or Q)";
+
+        map<int, Entity>::const_iterator it = scene.entities().find(id);
+        if(it == scene.entities().end())
+            throw "no such entity";
+
+        if((what == "i") != (it->second.type == Entity::CURRENT))
+            throw "entity is not of that type";
+
+        /* cached basis fields re-weight when next used */
+        scene.set_strength(id, val);
+        cout << "Set " << id << "." << endl;
+    }
+    else if(cmd == "probes")
+    {
+        string type;
+        if(ss >> type)
+        {
+            vector<vec3> pts;
+            vec3 pt;
+            while(ss >> pt)
+                pts.push_back(pt);
+
+            if(pts.empty())
+                throw "probes requires <E/B> <point> [<point>..]";
+
+            probe_type = (type == "e") ? FieldType::E : FieldType::B;
+            probe_points = pts;
+            probe_field = BasisField(pts.size());
+        }
+
+        if(probe_points.empty())
+            throw "no probe points set (probes <E/B> <point> [<point>..])";
+
+        scene.reset_stats();
+
+        ProfileScope integrating(prof_integration);
+        integrating.units = probe_points.size();
+
+        /* as with grids, the sources finished are kept */
+        Operation op("probes");
+        scene.update_basis(probe_field, probe_type,
+                           [](size_t i) { return probe_points[i]; }, *pool, &op);
+        op.check();
+        integrating.stop();
+
+        for(size_t i = 0; i < probe_points.size(); i++)
+        {
+            vec3 f = probe_field.total[i];
+            cout << probe_points[i] << ": " << f << " (magnitude " << f.magnitude() << ")" << endl;
+        }
+
+        report_quad_stats(probe_points.size());
+    }
+    else if(cmd == "field")
+    {
+        string type;
+
+        vec3 lower, upper;
+        scalar delta;
+
+        if(!(ss >> type >> lower >> upper >> delta) || delta <= 0)
+            throw "plot requires <E/B> <lower> <upper> delta";
+
+        FieldType t = (type == "e") ? FieldType::E : FieldType::B;
+
+        FieldGrid grid(t, lower, upper, delta);
+
+        if(background)
+            start_job(line, grid);
+        else
+        {
+            compute_field(grid);
+            plot_field(grid);
+        }
+    }
+    else if(cmd == "fieldline")
+    {
+        string type;
+        vec3 lower, upper;
+
+        if(!(ss >> type >> lower >> upper))
+            throw "fieldline requires <E/B> <lower> <upper> {<seed>..|grid <from> <to> DELTA}";
+
+        FieldType t = (type == "e") ? FieldType::E : FieldType::B;
+
+        vector<vec3> seeds;
+
+        ss >> ws;
+        if(ss.peek() == 'g')
+        {
+            string grid;
+            vec3 from, to;
+            scalar delta;
+
+            if(!(ss >> grid >> from >> to >> delta) || grid != "grid" || delta <= 0)
+                throw "fieldline grid requires <from> <to> DELTA";
+
+            for(scalar z : grid_axis(from[2], to[2], delta))
+                for(scalar y : grid_axis(from[1], to[1], delta))
+                    for(scalar x : grid_axis(from[0], to[0], delta))
+                        seeds.push_back(vec3(x, y, z));
+        }
+        else
+        {
+            vec3 seed;
+            while(ss >> seed)
+                seeds.push_back(seed);
+        }
+
+        if(seeds.empty())
+            throw "fieldline requires at least one seed point";
+
+        int n = 0;
+        string data = send_plot_data("fieldline", false, [&](ostream &out) {
+                n = dump_fieldlines(out, t, lower, upper, seeds);
+            });
+
+        plot("for[i = 0:" + itoa(n - 1) + "] " + data + " i i w lines");
+    }
+    else if(cmd == "probe")
+    {
+        string type;
+        vec3 pt;
+
+        if(!(ss >> type >> pt))
+            throw "probe requires <E/B> <point>";
+
+        scene.reset_stats();
+
+        ProfileScope integrating(prof_integration);
+        integrating.units = 1;
+        vec3 f = scene.field(type == "e" ? FieldType::E : FieldType::B, pt);
+        integrating.stop();
+        cout << f << " (magnitude " << f.magnitude() << ")" << endl;
+
+        report_quad_stats(1);
+    }
+    else if(cmd == "draw")
+    {
+        int e_types = 0;
+
+        while(ss)
+        {
+            string type_str;
+            if(ss >> type_str)
+            {
+                if(type_str == "i")
+                    e_types |= Entity::CURRENT;
+                else if(type_str == "q")
+                    e_types |= Entity::CHARGE;
+                else
+                    throw "unknown entity type (must be I or Q)";
+            }
+        }
+
+        if(!e_types)
+            e_types |= Entity::CHARGE | Entity::CURRENT;
+
+        int n = 0;
+        string data = send_plot_data("draw", false, [&](ostream &out) {
+                n = dump_entities(out, e_types,
+                                  scene.entities());
+            });
+
+        plot("for[i = 0:" + itoa(n - 1) + "] " + data + " i i w vectors");
+    }
+    else if(cmd == "delta")
+    {
+        scalar d = 0;
+        ss >> d;
+        if(d <= 0)
+        {
+            cerr << "D must be positive and non-zero!" << endl;
+            d = DEFAULT_D;
+        }
 
-                if(!e_types)
-                    e_types |= Entity::CHARGE | Entity::CURRENT;
+        scene.set_delta(d);
+        clear_basis_fields();
+    }
+    else if(cmd == "threads")
+    {
+        int n;
+        if(!(ss >> n) || n < 0)
+            throw "threads requires a non-negative count";
 
-                ofstream out;
-                string fname = gp->create_tmpfile(out);
-                int n = dump_entities(out, e_types,
-                                      entities);
-                out.close();
+        set_threads(n);
+        cout << "Using " << pool->size() << " thread(s)." << endl;
+    }
+    else if(cmd == "solver")
+    {
+        string name;
+        if(ss >> name)
+        {
+            if(name == "direct")
+                scene.set_solver(SOLVER_DIRECT);
+            else if(name == "tree")
+                scene.set_solver(SOLVER_TREE);
+            else if(name == "fmm")
+                scene.set_solver(SOLVER_FMM);
+            else
+                throw "solver must be direct, tree, or fmm";
+        }
 
-                string cmd = plot_cmd + " for[i = 0:" + itoa(n - 1) + "] '" + fname + "' i i w vectors";
-                *gp << cmd;
+        const char *names[] = { "direct", "tree", "fmm" };
+        cout << "Solver: " << names[scene.solver()] << endl;
+    }
+    else if(cmd == "accuracy")
+    {
+        scalar theta = -1;
+        ss >> theta;
+        if(theta < 0)
+        {
+            cerr << "THETA must be non-negative!" << endl;
+            theta = DEFAULT_THETA;
+        }
 
-                plot_cmd = "replot";
+        scene.set_theta(theta);
+    }
+    else if(cmd == "order")
+    {
+        int p = 0;
+        ss >> p;
+        if(p < 1 || p > MAX_ORDER)
+        {
+            cerr << "P must be between 1 and " << MAX_ORDER << "!" << endl;
+            p = DEFAULT_ORDER;
+        }
+
+        scene.set_fmm_order(p);
+    }
+    else if(cmd == "quadrature")
+    {
+        string name;
+        if(ss >> name)
+        {
+            if(name == "uniform")
+                scene.set_quadrature(QUAD_UNIFORM);
+            else if(name == "adaptive")
+                scene.set_quadrature(QUAD_ADAPTIVE);
+            else if(name == "gauss")
+            {
+                int n = DEFAULT_GAUSS_N;
+                ss >> n;
+                if(n < 1 || n > MAX_GAUSS_N)
+                    throw "gauss order out of range";
+
+                scene.set_quadrature(QUAD_GAUSS, n);
             }
-            else if(cmd == "delta")
+            else
+                throw "quadrature must be uniform, adaptive, or gauss N";
+
+            clear_basis_fields();
+        }
+
+        if(scene.quadrature() == QUAD_GAUSS)
+            cout << "Quadrature: gauss " << scene.gauss_order() << endl;
+        else
+            cout << "Quadrature: " << (scene.quadrature() == QUAD_ADAPTIVE ? "adaptive" : "uniform") << endl;
+    }
+    else if(cmd == "convergence")
+    {
+        string type;
+        vec3 pt;
+        int n = scene.gauss_order();
+
+        if(!(ss >> type >> pt))
+            throw "convergence requires <E/B> <point> [N]";
+        ss >> n;
+        if(n < 1 || n > MAX_GAUSS_N)
+            throw "gauss order out of range";
+
+        print_convergence(type == "e" ? FieldType::E : FieldType::B, pt, n);
+    }
+    else if(cmd == "tol")
+    {
+        Tolerance t = { 0, 0 };
+        if(!(ss >> t.rel))
+            throw "tol requires REL [ABS]";
+        ss >> t.abs;
+
+        if(t.rel < 0 || t.abs < 0 || (t.rel == 0 && t.abs == 0))
+        {
+            cerr << "Tolerances must be non-negative and not both zero!" << endl;
+            t = DEFAULT_TOL;
+        }
+
+        scene.set_tolerance(t);
+        clear_basis_fields();
+    }
+    else if(cmd == "analytic")
+    {
+        string state;
+        if(ss >> state)
+        {
+            if(state != "on" && state != "off")
+                throw "analytic must be on or off";
+
+            scene.set_analytic(state == "on");
+            clear_basis_fields();
+        }
+
+        cout << "Analytic sources: " << (scene.analytic() ? "on" : "off") << endl;
+    }
+    else if(cmd == "kernel")
+    {
+        string isa;
+        if(ss >> isa)
+        {
+            /* the kernels in use are global */
+            if(!jobs.empty())
+                throw "cannot change the kernel while background jobs run";
+
+            KernelISA want;
+            if(isa == "auto")
+                want = ISA_AUTO;
+            else if(isa == "scalar")
+                want = ISA_SCALAR;
+            else if(isa == "avx2")
+                want = ISA_AVX2;
+            else if(isa == "avx512")
+                want = ISA_AVX512;
+            else
+                throw "kernel must be auto, scalar, avx2, or avx512";
+
+            if(set_kernel_isa(want) != want && want != ISA_AUTO)
+                cerr << "Not supported on this CPU; falling back." << endl;
+            clear_basis_fields();
+        }
+
+        cout << "Kernel: " << kernel_isa_name(kernel_isa()) << endl;
+    }
+    else if(cmd == "output")
+    {
+        string mode;
+        if(ss >> mode)
+        {
+            if(mode == "text")
+                output = OUTPUT_TEXT;
+            else if(mode == "binary")
             {
-                ss >> D;
-                if(D <= 0)
+                string prec;
+                output = OUTPUT_BINARY;
+
+                if(ss >> prec)
                 {
-                    cerr << "D must be positive and non-zero!" << endl;
-                    D = DEFAULT_D;
+                    if(prec == "float32" || prec == "float")
+                        binary_format = FLOAT32;
+                    else if(prec == "float64" || prec == "double")
+                        binary_format = FLOAT64;
+                    else
+                        throw "binary precision must be float32 or float64";
                 }
             }
-            else if(cmd == "newwindow")
+            else
+                throw "output must be text or binary";
+        }
+
+        cout << "Output: ";
+        if(output == OUTPUT_BINARY)
+            cout << "binary " << (binary_format == FLOAT32 ? "float32" : "float64") << endl;
+        else
+            cout << "text" << endl;
+    }
+    else if(cmd == "cache")
+    {
+        int n;
+        if(ss >> n)
+        {
+            if(n < 0)
+                throw "cache size must be non-negative";
+
+            scalar mb;
+            if(ss >> mb)
             {
-                plot_cmd = "splot";
+                if(mb < 0)
+                    throw "cache memory must be non-negative";
+                grid_cache.set_byte_limit(mb * MB);
             }
-            else if(cmd == "help")
-                print_help();
+
+            grid_cache.set_capacity(n);
+        }
+
+        cout << "Grid cache: " << grid_cache.size() << " of " << grid_cache.capacity() << " grid(s), "
+             << (scalar)grid_cache.bytes() / MB << " of " << (scalar)grid_cache.byte_limit() / MB << " MB" << endl;
+    }
+    else if(cmd == "transport")
+    {
+        string mode;
+        if(ss >> mode)
+        {
+            if(mode == "pipe")
+                transport = TRANSPORT_PIPE;
+            else if(mode == "tmpfile")
+                transport = TRANSPORT_TMPFILE;
             else
+                throw "transport must be pipe or tmpfile";
+        }
+
+        cout << "Transport: " << (transport == TRANSPORT_PIPE ? "pipe" : "tmpfile") << endl;
+    }
+    else if(cmd == "profile")
+    {
+        string state;
+        if(ss >> state)
+        {
+            if(state == "on" || state == "hw")
+            {
+                start_profile();
+
+                string why;
+                hw_enabled = false;
+                if(state == "hw" && !(hw_enabled = hw_available(why)))
+                    cerr << "CPU counters unavailable: " << why << endl;
+            }
+            else if(state == "off")
+                stop_profile();
+            else
+                throw "profile must be on, hw, or off";
+        }
+
+        cout << "Profiling: " << (profiling() ? (hw_counting() ? "on, with CPU counters" : "on") : "off") << endl;
+    }
+    else if(cmd == "stats")
+        print_stats();
+    else if(cmd == "jobs")
+    {
+        /* batch scripts collect at wait, for repeatable output */
+        int failed = batch ? 0 : collect_jobs();
+
+        if(jobs.empty())
+            cout << "No background jobs." << endl;
+
+        for(auto &j : jobs)
+        {
+            const Job &job = *j.second;
+            const Progress &p = job.progress;
+
+            cout << "[" << job.id << "] ";
+            if(p.cancelled())
+                cout << "cancelling";
+            else if(job.finished)
+                cout << "finished";
+            else
+            {
+                cout << "running, " << (p.total() ? 100 * p.done() / p.total() : 0) << "%";
+                if(p.eta() >= 0)
+                    cout << ", about " << (int)ceil(p.eta()) << " s left";
+            }
+            cout << ": " << job.command << endl;
+        }
+
+        if(failed)
+            throw "background job failed";
+    }
+    else if(cmd == "wait")
+    {
+        /* a job that has already been collected needs no waiting */
+        int id = 0;
+        if(ss >> id && (id <= 0 || id >= job_counter))
+            throw "no such job";
+
+        if(wait_jobs(id))
+            throw "background job failed";
+    }
+    else if(cmd == "cancel")
+    {
+        int id;
+        if(!(ss >> id))
+            throw "cancel requires a job ID";
+        if(id <= 0 || id >= job_counter)
+            throw "no such job";
+
+        if(jobs.count(id))
+        {
+            jobs[id]->progress.cancel();
+            cout << "Cancelling [" << id << "]." << endl;
+        }
+        else
+            cout << "[" << id << "] has already finished." << endl;
+    }
+    else if(cmd == "trace")
+    {
+        /* not lowercased */
+        string word, path;
+        stringstream orig(raw_line);
+        orig >> word >> path;
+
+        if(path == "off" || path == "OFF")
+            finish_trace();
+        else if(!path.empty())
+        {
+            finish_trace();
+            trace_path = path;
+            trace_start();
+        }
+
+        if(trace_path.empty())
+            cout << "Trace: off" << endl;
+        else
+            cout << "Trace: recording to " << trace_path << endl;
+    }
+    else if(cmd == "newwindow")
+    {
+        plot_cmd = "splot";
+    }
+    else if(cmd == "help")
+        print_help();
+    else
+        return false;
+
+    return true;
+}
+
+/* exit statuses */
+const int EXIT_SCRIPT_ERROR = 1;
+const int EXIT_USAGE = 2;
+
+/* Run a script without readline or gnuplot, writing plot data to files
+ * under out_dir; stops at the first failing command. */
+int run_batch(const string &script, const string &out_dir)
+{
+    ifstream in(script);
+    if(!in)
+    {
+        cerr << script << ": cannot open" << endl;
+        return EXIT_USAGE;
+    }
+
+    struct stat st;
+    if(stat(out_dir.c_str(), &st) != 0)
+    {
+        if(mkdir(out_dir.c_str(), 0755) != 0)
+        {
+            cerr << out_dir << ": cannot create directory" << endl;
+            return EXIT_USAGE;
+        }
+    }
+    else if(!S_ISDIR(st.st_mode))
+    {
+        cerr << out_dir << ": not a directory" << endl;
+        return EXIT_USAGE;
+    }
+
+    batch = true;
+    batch_dir = out_dir;
+
+    string line;
+    int lineno = 0;
+    while(getline(in, line))
+    {
+        lineno++;
+
+        try {
+            if(!run_command(line))
+                throw "invalid command";
+        } catch(const char *err) {
+            cerr << script << ":" << lineno << ": " << err << endl;
+            abandon_jobs();
+            return EXIT_SCRIPT_ERROR;
+        }
+    }
+
+    /* results of jobs the script did not wait for */
+    if(wait_jobs(0))
+    {
+        cerr << script << ": background job failed" << endl;
+        return EXIT_SCRIPT_ERROR;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned n_threads = 0;
+    string script, out_dir;
+
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--threads" && i + 1 < argc)
+            n_threads = atoi(argv[++i]);
+        else if(arg == "--batch" && i + 1 < argc)
+            script = argv[++i];
+        else if(arg == "--out" && i + 1 < argc)
+            out_dir = argv[++i];
+        else if(arg == "--trace" && i + 1 < argc)
+            trace_path = argv[++i];
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--threads N] [--trace FILE] [--batch SCRIPT [--out DIR]]" << endl;
+            return EXIT_USAGE;
+        }
+    }
+
+    set_threads(n_threads);
+
+    if(!trace_path.empty())
+        trace_start();
+
+    if(!script.empty())
+    {
+        int status = run_batch(script, out_dir.empty() ? "." : out_dir);
+        finish_trace();
+        return status;
+    }
+    else if(!out_dir.empty())
+    {
+        cerr << "--out requires --batch" << endl;
+        return EXIT_USAGE;
+    }
+
+    hist_path = getenv("HOME");
+    hist_path += "/";
+    hist_path += HISTORY_FILE;
+
+    using_history();
+    read_history(hist_path.c_str());
+    atexit(exit_handler);
+    signal(SIGINT, int_handler);
+
+    /* finished jobs are plotted while waiting at the prompt; readline
+     * only polls the hook reliably on a terminal */
+    if(isatty(STDIN_FILENO))
+        rl_event_hook = poll_jobs;
+    rl_signal_event_hook = prompt_signal;
+
+    cout << "Welcome to fieldviz!" << endl << endl;
+    cout << "Type `help' for a command listing." << endl;
+
+    while(1)
+    {
+        at_prompt = 1;
+        char *cs = readline("fieldviz> ");
+        at_prompt = 0;
+        prompt_interrupted = 0;
+        if(!cs)
+            return 0;
+        add_history(cs);
+
+        string line(cs);
+
+        free(cs);
+
+        try {
+            if(!run_command(line))
                 cerr << "invalid" << endl;
         } catch(const char *err) {
             cerr << "parse error: " << err << endl;
+        } catch(const GnuplotException &e) {
+            cerr << "gnuplot: " << e.what() << endl;
         }
+
+        collect_jobs();
     }
 
     //LineSegment wire(vec3(0, -100, 0), vec3(0, 100, 0));
@@ -523,19 +1937,4 @@ int main(int argc, char *argv[])
 
     //for(int i = 0; i < 1000; i++, point += dx)
     //std::cout << point[0] << " " << U0 / ( 4 * M_PI ) * loop.integrate(dB, 1e-2)[0] << endl;
-
-#if 0
-    mkdir("field", 0755);
-
-    for(scalar y = -1.5; y <= 1.5; y += .1)
-    {
-        stringstream ss;
-        ss << "field/" << y << ".fld";
-        ofstream ofs(ss.str());
-
-        dump_fieldline(ofs, vec3(0, y, 0), 10);
-
-        ofs.close();
-    }
-#endif
 }
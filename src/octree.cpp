@@ -0,0 +1,214 @@
+#include "octree.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace fml;
+
+namespace fieldviz {
+
+/* elements per leaf */
+static const size_t LEAF_SIZE = 16;
+
+/* stop splitting coincident points */
+static const int MAX_DEPTH = 32;
+
+void Octree::clear()
+{
+    pos.clear();
+    J.clear();
+    q.clear();
+    nodes.clear();
+}
+
+void Octree::add(vec3 s, vec3 j)
+{
+    pos.push_back(s);
+    J.push_back(j);
+}
+
+void Octree::add(vec3 s, scalar charge)
+{
+    pos.push_back(s);
+    q.push_back(charge);
+}
+
+void Octree::swap_elements(size_t a, size_t b)
+{
+    std::swap(pos[a], pos[b]);
+    if(kind == CURRENT)
+        std::swap(J[a], J[b]);
+    else
+        std::swap(q[a], q[b]);
+}
+
+void Octree::build()
+{
+    nodes.clear();
+
+    if(pos.empty())
+        return;
+
+    vec3 lo = pos[0], hi = pos[0];
+    for(const vec3 &s : pos)
+        for(int k = 0; k < 3; k++)
+        {
+            lo[k] = std::min(lo[k], s[k]);
+            hi[k] = std::max(hi[k], s[k]);
+        }
+
+    scalar width = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+
+    /* keep degenerate (single point) trees finite */
+    if(width <= 0)
+        width = 1;
+
+    build_node((lo + hi) / 2, width, 0, pos.size(), 0);
+}
+
+int Octree::build_node(vec3 center, scalar width, size_t begin, size_t end, int depth)
+{
+    int idx = nodes.size();
+    nodes.push_back(Node());
+
+    Node n = Node();
+    n.center = center;
+    n.width = width;
+    n.begin = begin;
+    n.end = end;
+    n.leaf = (end - begin <= LEAF_SIZE || depth >= MAX_DEPTH);
+    n.J = 0;
+    n.A = 0;
+    n.p = 0;
+
+    for(size_t i = begin; i < end; i++)
+    {
+        vec3 d = pos[i] - center;
+
+        if(kind == CURRENT)
+        {
+            n.J += J[i];
+            n.A += J[i].cross(d);
+            for(int k = 0; k < 3; k++)
+                for(int l = 0; l < 3; l++)
+                    n.M[k][l] += J[i][k] * d[l];
+        }
+        else
+        {
+            n.q += q[i];
+            n.p += d * q[i];
+        }
+    }
+
+    if(!n.leaf)
+    {
+        /* sort elements into octants: bit k set means above center on axis k */
+        size_t bounds[9];
+        bounds[0] = begin;
+
+        size_t next = begin;
+        for(int oct = 0; oct < 8; oct++)
+        {
+            for(size_t i = next; i < end; i++)
+            {
+                int o = 0;
+                for(int k = 0; k < 3; k++)
+                    if(pos[i][k] >= center[k])
+                        o |= 1 << k;
+
+                if(o == oct)
+                    swap_elements(i, next++);
+            }
+            bounds[oct + 1] = next;
+        }
+
+        for(int oct = 0; oct < 8; oct++)
+        {
+            if(bounds[oct] == bounds[oct + 1])
+            {
+                n.children[oct] = -1;
+                continue;
+            }
+
+            vec3 c = center;
+            for(int k = 0; k < 3; k++)
+                c[k] += (oct & (1 << k)) ? width / 4 : -width / 4;
+
+            n.children[oct] = build_node(c, width / 2, bounds[oct], bounds[oct + 1], depth + 1);
+        }
+    }
+
+    nodes[idx] = n;
+    return idx;
+}
+
+vec3 Octree::direct(const Node &n, vec3 x) const
+{
+    vec3 f = 0;
+
+    for(size_t i = n.begin; i < n.end; i++)
+    {
+        vec3 r = x - pos[i];
+        scalar r2 = r.magnitudeSquared();
+        scalar inv = 1 / (r2 * std::sqrt(r2));
+
+        if(kind == CURRENT)
+            f += J[i].cross(r) * inv;
+        else
+            f += r * (q[i] * inv);
+    }
+
+    return f;
+}
+
+vec3 Octree::expansion(const Node &n, vec3 x) const
+{
+    vec3 R = x - n.center;
+    scalar R2 = R.magnitudeSquared();
+    scalar inv3 = 1 / (R2 * std::sqrt(R2));
+    scalar inv5 = inv3 / R2;
+
+    if(kind == CURRENT)
+    {
+        vec3 MR;
+        for(int k = 0; k < 3; k++)
+            MR[k] = n.M[k][0] * R[0] + n.M[k][1] * R[1] + n.M[k][2] * R[2];
+
+        return n.J.cross(R) * inv3 - n.A * inv3 + MR.cross(R) * (3 * inv5);
+    }
+    else
+        return R * (n.q * inv3) - n.p * inv3 + R * (3 * R.dot(n.p) * inv5);
+}
+
+vec3 Octree::field(vec3 x, scalar theta) const
+{
+    vec3 f = 0;
+
+    if(nodes.empty())
+        return f;
+
+    std::vector<int> stack;
+    stack.reserve(8 * MAX_DEPTH);
+    stack.push_back(0);
+
+    while(!stack.empty())
+    {
+        const Node &n = nodes[stack.back()];
+        stack.pop_back();
+
+        scalar d2 = (x - n.center).magnitudeSquared();
+
+        if(n.width * n.width < theta * theta * d2)
+            f += expansion(n, x);
+        else if(n.leaf)
+            f += direct(n, x);
+        else
+            for(int c = 0; c < 8; c++)
+                if(n.children[c] >= 0)
+                    stack.push_back(n.children[c]);
+    }
+
+    return f;
+}
+
+} /* namespace fieldviz */
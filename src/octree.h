@@ -0,0 +1,79 @@
+#ifndef FIELDVIZ_OCTREE_H
+#define FIELDVIZ_OCTREE_H
+
+#include <cstddef>
+#include <vector>
+
+#include <fml/fml.h>
+
+namespace fieldviz {
+
+/* Barnes-Hut treecode over discretized sources.
+ *
+ * A current tree holds elements J = I ds (times any constant) and
+ * evaluates sum J x r / |r|^3; a charge tree holds scalar charges q and
+ * evaluates sum q r / |r|^3.  Every node summarizes the elements below
+ * it by a monopole and dipole expansion about the node's center, which
+ * is used instead of visiting the node whenever
+ *
+ *   node width / distance < theta
+ *
+ * theta = 0 never approximates and reduces to an exact direct sum. */
+class Octree {
+public:
+    enum Kind { CURRENT, CHARGE };
+
+    explicit Octree(Kind kind = CURRENT) : kind(kind) {}
+
+    void clear();
+
+    /* for current trees */
+    void add(fml::vec3 pos, fml::vec3 J);
+
+    /* for charge trees */
+    void add(fml::vec3 pos, fml::scalar q);
+
+    /* partition the added elements and compute node expansions */
+    void build();
+
+    fml::vec3 field(fml::vec3 x, fml::scalar theta) const;
+
+    size_t size() const { return pos.size(); }
+
+private:
+    struct Node {
+        fml::vec3 center;
+        fml::scalar width;
+
+        /* elements [begin, end), children[] valid unless leaf */
+        size_t begin, end;
+        int children[8];
+        bool leaf;
+
+        /* monopole: total J (current) or total q (charge) */
+        fml::vec3 J;
+        fml::scalar q;
+
+        /* dipole, with d = element position - center:
+         *   current: M[k][l] = sum J_k d_l, A = sum J x d
+         *   charge:  p = sum q d */
+        fml::scalar M[3][3];
+        fml::vec3 A, p;
+    };
+
+    Kind kind;
+
+    std::vector<fml::vec3> pos, J;
+    std::vector<fml::scalar> q;
+    std::vector<Node> nodes;
+
+    int build_node(fml::vec3 center, fml::scalar width, size_t begin, size_t end, int depth);
+    void swap_elements(size_t a, size_t b);
+
+    fml::vec3 direct(const Node &n, fml::vec3 x) const;
+    fml::vec3 expansion(const Node &n, fml::vec3 x) const;
+};
+
+} /* namespace fieldviz */
+
+#endif
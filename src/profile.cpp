@@ -0,0 +1,15 @@
+#include "profile.h"
+
+#include <chrono>
+
+namespace fieldviz {
+
+std::atomic<bool> profile_enabled{false};
+
+uint64_t profile_clock()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,86 @@
+#ifndef FIELDVIZ_PROFILE_H
+#define FIELDVIZ_PROFILE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "hwcounters.h"
+
+namespace fieldviz {
+
+/* Hot-path counters, collected only while profiling is on.  With it
+ * off, each instrumented spot costs one relaxed load and a branch. */
+
+extern std::atomic<bool> profile_enabled;
+
+inline bool profiling()
+{
+    return profile_enabled.load(std::memory_order_relaxed);
+}
+
+/* monotonic nanoseconds */
+uint64_t profile_clock();
+
+/* Work done by one source or phase: how often it ran, how many units
+ * of work that was (kernel evaluations, bytes, ...), and for how long,
+ * plus CPU counters where those are sampled.  Safe to update from any
+ * number of threads. */
+struct ProfileCounter {
+    std::atomic<size_t> calls{0}, units{0};
+    std::atomic<uint64_t> ns{0};
+    HwTotals hw;
+
+    void add(size_t n_units, uint64_t n_ns)
+    {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        units.fetch_add(n_units, std::memory_order_relaxed);
+        ns.fetch_add(n_ns, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        calls = 0;
+        units = 0;
+        ns = 0;
+        hw.reset();
+    }
+
+    double seconds() const { return ns * 1e-9; }
+};
+
+/* adds the time until it goes out of scope to a counter, if profiling
+ * was on when it was created */
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileCounter &c) : counter(c), on(profiling())
+    {
+        if(on)
+            start = profile_clock();
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    ~ProfileScope() { stop(); }
+
+    /* account for the time so far, and stop */
+    void stop()
+    {
+        if(on)
+            counter.add(units, profile_clock() - start);
+        on = false;
+    }
+
+    /* work to credit along with the time */
+    size_t units = 0;
+
+private:
+    ProfileCounter &counter;
+    bool on;
+    uint64_t start = 0;
+};
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,40 @@
+#include "progress.h"
+
+#include "profile.h"
+
+namespace fieldviz {
+
+Progress::Progress(size_t total) : n_total(total), start(profile_clock()), last_report(start)
+{
+}
+
+void Progress::advance(size_t n)
+{
+    n_done += n;
+
+    if(!reporter)
+        return;
+
+    uint64_t now = profile_clock(), last = last_report;
+    if(now - last < interval * 1e9)
+        return;
+
+    /* whoever moves last_report on reports */
+    if(last_report.compare_exchange_strong(last, now))
+        reporter(*this);
+}
+
+double Progress::elapsed() const
+{
+    return (profile_clock() - start) * 1e-9;
+}
+
+double Progress::eta() const
+{
+    size_t d = n_done, t = n_total;
+    if(!d)
+        return -1;
+    return elapsed() * (t > d ? t - d : 0) / d;
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,53 @@
+#ifndef FIELDVIZ_PROGRESS_H
+#define FIELDVIZ_PROGRESS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace fieldviz {
+
+/* Tracks a long operation: units of work done out of a total, and
+ * whether it has been asked to stop.  Workers check cancelled() between
+ * units of work and stop early once it is set; whatever they finished
+ * is left for the caller to keep or discard.  All members may be used
+ * from any thread, and cancel() also from a signal handler. */
+class Progress {
+public:
+    explicit Progress(size_t total = 0);
+
+    Progress(const Progress &) = delete;
+    Progress &operator=(const Progress &) = delete;
+
+    void add_total(size_t n) { n_total += n; }
+
+    /* n more units done; calls the reporter if one is due */
+    void advance(size_t n);
+
+    void cancel() { stop = true; }
+    bool cancelled() const { return stop.load(std::memory_order_relaxed); }
+
+    size_t done() const { return n_done; }
+    size_t total() const { return n_total; }
+
+    /* seconds since construction, and the estimated time remaining
+     * (negative until something is done) */
+    double elapsed() const;
+    double eta() const;
+
+    /* Called from advance(), on whichever thread is working, every
+     * `interval' seconds at most. */
+    std::function<void(const Progress &)> reporter;
+    double interval = 1;
+
+private:
+    std::atomic<size_t> n_done{0}, n_total;
+    std::atomic<bool> stop{false};
+    uint64_t start;
+    std::atomic<uint64_t> last_report;
+};
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,317 @@
+#include "quadrature.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <vector>
+
+using namespace fml;
+using std::vector;
+
+namespace fieldviz {
+
+/* Kronrod nodes on [-1, 1] (positive half; the Gauss nodes are the odd
+ * ones), with their Kronrod and Gauss weights */
+static const scalar GK_X[8] = {
+    0.991455371120812639206854697526329,
+    0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013,
+    0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245,
+    0.000000000000000000000000000000000,
+};
+
+static const scalar GK_WK[8] = {
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714,
+};
+
+static const scalar GK_WG[4] = {
+    0.129484966168869693270611432679082,
+    0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327,
+};
+
+/* inner integrals allowed per surface patch and observation point */
+static const size_t ADAPTIVE_MAX_OUTER_EVALS = 3000;
+
+static vec3 integrand(Integrand f, vec3 x, vec3 s, vec3 ds)
+{
+    vec3 r = x - s;
+    scalar r2 = r.magnitudeSquared();
+    scalar inv = 1 / (r2 * std::sqrt(r2));
+
+    if(f == BIOT_SAVART)
+        return ds.cross(r) * inv;
+    else
+        return r * (ds.magnitude() * inv);
+}
+
+namespace {
+
+struct Panel {
+    scalar a, b;
+    vec3 value;
+    scalar err;
+
+    bool operator<(const Panel &o) const { return err < o.err; }
+};
+
+typedef std::function<vec3(scalar)> Fn;
+
+Panel gauss_kronrod(const Fn &g, scalar a, scalar b, size_t &evals)
+{
+    scalar mid = (a + b) / 2, half = (b - a) / 2;
+
+    vec3 center = g(mid);
+    vec3 kronrod = center * GK_WK[7], gauss = center * GK_WG[3];
+
+    for(int i = 0; i < 7; i++)
+    {
+        vec3 sum = g(mid - half * GK_X[i]) + g(mid + half * GK_X[i]);
+
+        kronrod += sum * GK_WK[i];
+        if(i & 1)
+            gauss += sum * GK_WG[i / 2];
+    }
+
+    evals += 15;
+
+    Panel p;
+    p.a = a;
+    p.b = b;
+    p.value = kronrod * half;
+    p.err = ((kronrod - gauss) * half).magnitude();
+    return p;
+}
+
+/* integral of g over [a, b], starting from n equal panels */
+vec3 adaptive(const Fn &g, scalar a, scalar b, int n, Tolerance tol,
+              size_t max_evals, QuadratureStats &stats)
+{
+    std::priority_queue<Panel> panels;
+    size_t evals = 0;
+
+    vec3 total = 0;
+    scalar err = 0;
+
+    for(int i = 0; i < n; i++)
+    {
+        Panel p = gauss_kronrod(g, a + (b - a) * i / n, a + (b - a) * (i + 1) / n, evals);
+        total += p.value;
+        err += p.err;
+        panels.push(p);
+    }
+
+    while(err > std::max(tol.abs, tol.rel * total.magnitude()))
+    {
+        if(evals + 30 > max_evals)
+        {
+            stats.unconverged++;
+            break;
+        }
+
+        Panel worst = panels.top();
+        panels.pop();
+
+        scalar mid = (worst.a + worst.b) / 2;
+        Panel l = gauss_kronrod(g, worst.a, mid, evals);
+        Panel r = gauss_kronrod(g, mid, worst.b, evals);
+
+        total += l.value + r.value - worst.value;
+        err += l.err + r.err - worst.err;
+
+        panels.push(l);
+        panels.push(r);
+    }
+
+    stats.evaluations += evals;
+    return total;
+}
+
+}
+
+vec3 adaptive_field(const Shape &shape, Integrand f, vec3 x,
+                    Tolerance tol, QuadratureStats &stats)
+{
+    vector<Patch> patches;
+    shape.patches(patches);
+
+    vec3 total = 0;
+
+    for(const Patch &p : patches)
+    {
+        if(p.dim == 1)
+        {
+            Fn g = [&](scalar u) {
+                vec3 s, ds;
+                p.at(u, 0, s, ds);
+                return integrand(f, x, s, ds);
+            };
+
+            total += adaptive(g, 0, p.u1, p.nu, tol, ADAPTIVE_MAX_EVALS, stats);
+        }
+        else
+        {
+            /* the inner integrals only need to be as good as the
+             * outer one can resolve */
+            Tolerance inner = { tol.rel, tol.abs / std::max(std::fabs(p.u1), (scalar)1e-300) };
+
+            Fn g = [&](scalar u) {
+                Fn h = [&](scalar v) {
+                    vec3 s, ds;
+                    p.at(u, v, s, ds);
+                    return integrand(f, x, s, ds);
+                };
+
+                return adaptive(h, 0, p.v1, p.nv, inner, ADAPTIVE_MAX_EVALS, stats);
+            };
+
+            /* outer evaluations are counted by the inner integrals */
+            QuadratureStats outer;
+            total += adaptive(g, 0, p.u1, p.nu, tol, ADAPTIVE_MAX_OUTER_EVALS, outer);
+            stats.unconverged += outer.unconverged;
+        }
+    }
+
+    return total;
+}
+
+void gauss_legendre(int n, vector<scalar> &x, vector<scalar> &w)
+{
+    x.assign(n, 0);
+    w.assign(n, 0);
+
+    /* Newton's method on P_n from the Chebyshev-like initial guesses;
+     * the roots are symmetric, so only half are computed */
+    for(int i = 0; i < (n + 1) / 2; i++)
+    {
+        scalar z = std::cos(M_PI * (i + .75) / (n + .5)), dp = 1;
+
+        for(int iter = 0; iter < 100; iter++)
+        {
+            /* P_n(z) and P_n'(z) by the three-term recurrence */
+            scalar p0 = 1, p1 = z;
+            for(int k = 2; k <= n; k++)
+            {
+                scalar p2 = ((2 * k - 1) * z * p1 - (k - 1) * p0) / k;
+                p0 = p1;
+                p1 = p2;
+            }
+
+            scalar pn = (n == 1) ? z : p1;
+            scalar pn1 = (n == 1) ? 1 : p0;
+            dp = n * (z * pn - pn1) / (z * z - 1);
+
+            scalar dz = pn / dp;
+            z -= dz;
+
+            if(std::fabs(dz) < 1e-16)
+                break;
+        }
+
+        if(n == 1)
+        {
+            z = 0;
+            dp = 1;
+        }
+
+        x[i] = -z;
+        x[n - 1 - i] = z;
+        w[i] = w[n - 1 - i] = 2 / ((1 - z * z) * dp * dp);
+    }
+}
+
+/* length of the patch along u (along = 0) or v (along = 1), the
+ * longest of a few parallel lines */
+static scalar patch_extent(const Patch &p, int along)
+{
+    const int LINES = 5, STEPS = 64;
+    scalar longest = 0;
+
+    for(int l = 0; l < LINES; l++)
+    {
+        scalar fixed = (along ? p.u1 : p.v1) * (l + .5) / LINES;
+        scalar len = 0;
+        vec3 prev, s, ds;
+
+        for(int i = 0; i <= STEPS; i++)
+        {
+            scalar t = (along ? p.v1 : p.u1) * i / STEPS;
+            if(along)
+                p.at(fixed, t, s, ds);
+            else
+                p.at(t, fixed, s, ds);
+
+            if(i)
+                len += (s - prev).magnitude();
+            prev = s;
+        }
+
+        longest = std::max(longest, len);
+
+        if(p.dim == 1)
+            break;
+    }
+
+    return longest;
+}
+
+void gauss_samples(const Shape &shape, int n, scalar spacing, SampleSet &out)
+{
+    out = SampleSet();
+    out.delta = spacing;
+
+    scalar panel = n * spacing;
+    out.gauss_order = n;
+
+    vector<scalar> x, w;
+    gauss_legendre(n, x, w);
+
+    vector<Patch> patches;
+    shape.patches(patches);
+
+    for(const Patch &p : patches)
+    {
+        int nu = std::max(p.nu, (int)std::ceil(patch_extent(p, 0) / panel));
+        int nv = (p.dim == 1) ? 1 : std::max(p.nv, (int)std::ceil(patch_extent(p, 1) / panel));
+
+        scalar hu = p.u1 / nu / 2, hv = (p.dim == 1) ? 1 : p.v1 / nv / 2;
+
+        for(int iu = 0; iu < nu; iu++)
+            for(int ju = 0; ju < n; ju++)
+            {
+                scalar u = (2 * iu + 1 + x[ju]) * hu;
+
+                if(p.dim == 1)
+                {
+                    vec3 s, ds;
+                    p.at(u, 0, s, ds);
+                    out.push_back(s, ds * (w[ju] * hu));
+                    continue;
+                }
+
+                for(int iv = 0; iv < nv; iv++)
+                    for(int jv = 0; jv < n; jv++)
+                    {
+                        scalar v = (2 * iv + 1 + x[jv]) * hv;
+
+                        vec3 s, ds;
+                        p.at(u, v, s, ds);
+                        out.push_back(s, ds * (w[ju] * hu * w[jv] * hv));
+                    }
+            }
+    }
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,55 @@
+#ifndef FIELDVIZ_QUADRATURE_H
+#define FIELDVIZ_QUADRATURE_H
+
+#include <cstddef>
+#include <vector>
+
+#include <fml/fml.h>
+
+#include "shape.h"
+#include "sources.h"
+
+namespace fieldviz {
+
+/* Integration over a Shape's own parametrization rather than libfml's
+ * fixed-step samples. */
+
+enum Integrand { BIOT_SAVART, COULOMB };
+
+struct Tolerance {
+    fml::scalar rel, abs;
+};
+
+struct QuadratureStats {
+    /* integrand evaluations */
+    size_t evaluations = 0;
+
+    /* times the evaluation cap was hit before reaching tolerance */
+    size_t unconverged = 0;
+};
+
+/* integrand evaluations allowed per patch and observation point */
+const size_t ADAPTIVE_MAX_EVALS = 200000;
+
+/* Globally adaptive 15-point Gauss-Kronrod integration of the chosen
+ * integrand (same units as biot_savart()/coulomb()) seen from x.
+ * Panels with the largest error estimate are bisected until the total
+ * estimate is within max(tol.abs, tol.rel * |result|).  Surfaces nest
+ * one adaptive integral inside another. */
+fml::vec3 adaptive_field(const Shape &shape, Integrand f, fml::vec3 x,
+                         Tolerance tol, QuadratureStats &stats);
+
+/* n-point Gauss-Legendre nodes and weights on [-1, 1] */
+void gauss_legendre(int n, std::vector<fml::scalar> &x, std::vector<fml::scalar> &w);
+
+/* Discretize a shape with n Gauss-Legendre nodes per panel (tensor
+ * rules on surfaces), with panels no longer than n * spacing along each
+ * parameter direction, so that nodes are on average no further apart
+ * than libfml's uniform samples at the same spacing.  Each sample's ds
+ * carries its quadrature weight, so the result drops into anything
+ * that consumes a SampleSet. */
+void gauss_samples(const Shape &shape, int n, fml::scalar spacing, SampleSet &out);
+
+} /* namespace fieldviz */
+
+#endif
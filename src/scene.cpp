@@ -0,0 +1,505 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <string>
+
+#include "analytic.h"
+#include "kernels.h"
+#include "trace.h"
+
+using namespace fml;
+
+namespace fieldviz {
+
+/* points per unit of work handed to a thread */
+static const size_t TILE = 256;
+
+int Scene::add_current(scalar I, std::shared_ptr<Manifold> path, const Shape &shape)
+{
+    Entity e;
+    e.type = Entity::CURRENT;
+    e.I = I;
+    e.path = path;
+    e.shape = shape;
+    return add_entity(e);
+}
+
+int Scene::add_charge(scalar Q_density, std::shared_ptr<Manifold> path, const Shape &shape)
+{
+    Entity e;
+    e.type = Entity::CHARGE;
+    e.Q_density = Q_density;
+    e.path = path;
+    e.shape = shape;
+    return add_entity(e);
+}
+
+int Scene::add_entity(Entity e)
+{
+    TraceSpan span("scene", "discretize");
+    if(span.active())
+        span.detail = e.path->name();
+
+    /* orient against libfml's own traversal */
+    e.samples.build(e.path.get(), D);
+    e.shape.orient(e.samples);
+    e.profile = std::make_shared<ProfileCounter>();
+
+    if(quad == QUAD_GAUSS)
+        build_samples(e);
+
+    ents[ent_counter] = e;
+    trees_stale = true;
+    return ent_counter++;
+}
+
+bool Scene::remove(int id)
+{
+    if(!ents.erase(id))
+        return false;
+
+    trees_stale = true;
+    return true;
+}
+
+bool Scene::set_strength(int id, scalar value)
+{
+    std::map<int, Entity>::iterator it = ents.find(id);
+    if(it == ents.end())
+        return false;
+
+    Entity &e = it->second;
+    if(e.type == Entity::CURRENT)
+        e.I = value;
+    else
+        e.Q_density = value;
+
+    trees_stale = true;
+    return true;
+}
+
+std::shared_ptr<const Scene> Scene::snapshot() const
+{
+    std::shared_ptr<Scene> s = std::make_shared<Scene>();
+
+    s->ent_counter = ent_counter;
+    s->ents = ents;
+    s->D = D;
+    s->quad = quad;
+    s->gauss_n = gauss_n;
+    s->tol = tol;
+    s->use_analytic = use_analytic;
+    s->solv = solv;
+    s->opening = opening;
+    s->order = order;
+
+    return s;
+}
+
+/* discretize with libfml's uniform steps, or Gauss-Legendre panels
+ * with about the same number of samples */
+void Scene::build_samples(Entity &e)
+{
+    if(quad == QUAD_GAUSS && e.shape.kind != Shape::NONE)
+        gauss_samples(e.shape, gauss_n, D, e.samples);
+    else
+        e.samples.build(e.path.get(), D);
+}
+
+/* resample every entity after D or the quadrature rule changes */
+void Scene::rebuild_samples()
+{
+    int want = (quad == QUAD_GAUSS) ? gauss_n : 0;
+
+    for(std::map<int, Entity>::iterator i = ents.begin(); i != ents.end(); i++)
+    {
+        Entity &e = i->second;
+        if(e.samples.delta != D || e.samples.gauss_order != want)
+        {
+            TraceSpan span("scene", "discretize");
+            if(span.active())
+                span.detail = "entity " + std::to_string(i->first);
+
+            build_samples(e);
+        }
+    }
+
+    trees_stale = true;
+}
+
+void Scene::set_delta(scalar d)
+{
+    D = d;
+    rebuild_samples();
+}
+
+void Scene::set_quadrature(Quadrature q, int n)
+{
+    quad = q;
+    if(q == QUAD_GAUSS)
+        gauss_n = n;
+    rebuild_samples();
+}
+
+void Scene::set_tolerance(const Tolerance &t)
+{
+    tol = t;
+    set_quadrature(QUAD_ADAPTIVE);
+}
+
+void Scene::set_solver(Solver s)
+{
+    solv = s;
+    trees_stale = true;
+}
+
+void Scene::set_fmm_order(int p)
+{
+    order = p;
+    trees_stale = true;
+}
+
+/* Rebuild the source trees if the entities have changed.  Concurrent
+ * callers wait for whichever got here first. */
+void Scene::prepare() const
+{
+    if(solv == SOLVER_DIRECT || !trees_stale)
+        return;
+
+    std::lock_guard<std::mutex> lock(prepare_mtx);
+    if(!trees_stale)
+        return;
+
+    TraceSpan span("scene", solv == SOLVER_TREE ? "build octree" : "build fmm");
+
+    current_tree.clear();
+    charge_tree.clear();
+    current_fmm.clear();
+    charge_fmm.clear();
+
+    for(std::map<int, Entity>::const_iterator i = ents.begin(); i != ents.end(); i++)
+    {
+        const Entity &e = i->second;
+        const SampleSet &s = e.samples;
+
+        for(size_t j = 0; j < s.size(); j++)
+        {
+            if(e.type == Entity::CURRENT)
+            {
+                vec3 J = s.element(j) * (K_M * e.I);
+                if(solv == SOLVER_TREE)
+                    current_tree.add(s.position(j), J);
+                else
+                    current_fmm.add(s.position(j), J);
+            }
+            else if(e.type == Entity::CHARGE)
+            {
+                scalar q = s.w[j] * (K_E * e.Q_density);
+                if(solv == SOLVER_TREE)
+                    charge_tree.add(s.position(j), q);
+                else
+                    charge_fmm.add(s.position(j), q);
+            }
+        }
+    }
+
+    if(solv == SOLVER_TREE)
+    {
+        current_tree.build();
+        charge_tree.build();
+    }
+    else
+    {
+        current_fmm.build(order);
+        charge_fmm.build(order);
+    }
+
+    trees_stale = false;
+}
+
+void Scene::add_stats(const QuadratureStats &stats) const
+{
+    if(stats.evaluations)
+        quad_evals += stats.evaluations;
+    if(stats.unconverged)
+        quad_failed += stats.unconverged;
+}
+
+void Scene::reset_stats() const
+{
+    quad_evals = 0;
+    quad_failed = 0;
+}
+
+void Scene::reset_profile() const
+{
+    for(std::map<int, Entity>::const_iterator i = ents.begin(); i != ents.end(); i++)
+        i->second.profile->reset();
+    solver_prof.reset();
+}
+
+vec3 Scene::unit_field(FieldType type, const Entity &e, vec3 x, QuadratureStats &stats) const
+{
+    if(!profiling())
+        return integrate(type, e, x, stats);
+
+    HwCounts hw_before, hw_after;
+    bool hw = hw_counting() && hw_read(hw_before);
+
+    uint64_t start = profile_clock();
+    size_t before = stats.evaluations;
+
+    vec3 f = integrate(type, e, x, stats);
+
+    uint64_t end = profile_clock();
+    if(hw && hw_read(hw_after))
+        e.profile->hw.add(hw_after - hw_before);
+
+    /* kernel evaluations: one for a closed form, else the samples or
+     * integrand evaluations */
+    size_t evals;
+    if(use_analytic && has_analytic(e.shape))
+        evals = 1;
+    else if(quad == QUAD_ADAPTIVE)
+        evals = stats.evaluations - before;
+    else
+        evals = e.samples.size();
+
+    e.profile->add(evals, end - start);
+
+    return f;
+}
+
+/* Adaptive quadrature works on the shape's parameters, so a source
+ * added without a Shape falls back to its samples, as Gauss panels do */
+vec3 Scene::integrate(FieldType type, const Entity &e, vec3 x, QuadratureStats &stats) const
+{
+    bool adaptive = quad == QUAD_ADAPTIVE && e.shape.kind != Shape::NONE;
+
+    if(type == FieldType::B)
+    {
+        if(use_analytic && has_analytic(e.shape))
+            return analytic_biot_savart(e.shape, x) * K_M;
+        else if(adaptive)
+            return adaptive_field(e.shape, BIOT_SAVART, x, tol, stats) * K_M;
+        else
+            return biot_savart(e.samples, x) * K_M;
+    }
+    else
+    {
+        if(use_analytic && has_analytic(e.shape))
+            return analytic_coulomb(e.shape, x) * K_E;
+        else if(adaptive)
+            return adaptive_field(e.shape, COULOMB, x, tol, stats) * K_E;
+        else
+            return coulomb(e.samples, x) * K_E;
+    }
+}
+
+vec3 Scene::direct_field(FieldType type, vec3 x) const
+{
+    int want = (type == FieldType::E) ? Entity::CHARGE : Entity::CURRENT;
+
+    vec3 f = 0;
+    QuadratureStats stats;
+
+    for(std::map<int, Entity>::const_iterator i = ents.begin(); i != ents.end(); i++)
+    {
+        const Entity &e = i->second;
+        if(e.type == want)
+            f += unit_field(type, e, x, stats) * (type == FieldType::E ? e.Q_density : e.I);
+    }
+
+    add_stats(stats);
+
+    return f;
+}
+
+vec3 Scene::field(FieldType type, vec3 x) const
+{
+    if(solv == SOLVER_TREE)
+    {
+        prepare();
+
+        ProfileScope prof(solver_prof);
+        prof.units = 1;
+        return (type == FieldType::E ? charge_tree : current_tree).field(x, opening);
+    }
+
+    return direct_field(type, x);
+}
+
+void Scene::field(FieldType type, const std::vector<vec3> &pts,
+                  std::vector<vec3> &out, ThreadPool &pool,
+                  Progress *progress) const
+{
+    size_t n = pts.size();
+    out.resize(n);
+
+    if(solv == SOLVER_FMM)
+    {
+        prepare();
+
+        ProfileScope prof(solver_prof);
+        prof.units = n;
+        TraceSpan span("field", "fmm");
+        (type == FieldType::E ? charge_fmm : current_fmm).evaluate(pts, out, pool, progress);
+        return;
+    }
+
+    size_t tiles = (n + TILE - 1) / TILE;
+
+    if(progress)
+        progress->add_total(n);
+
+    pool.parallel_for(tiles, [&](size_t tile) {
+            if(progress && progress->cancelled())
+                return;
+
+            size_t end = std::min(n, (tile + 1) * TILE);
+
+            TraceSpan span("field", "tile");
+            if(span.active())
+                span.detail = "points " + std::to_string(tile * TILE) + "-" + std::to_string(end);
+
+            for(size_t i = tile * TILE; i < end; i++)
+                out[i] = field(type, pts[i]);
+
+            if(progress)
+                progress->advance(end - tile * TILE);
+        });
+}
+
+void Scene::evaluate(FieldType type, const double *xyz, size_t n, double *out,
+                     ThreadPool *pool) const
+{
+    if(solv == SOLVER_FMM || pool)
+    {
+        std::vector<vec3> pts(n), f;
+        for(size_t i = 0; i < n; i++)
+            pts[i] = vec3(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+
+        if(pool)
+            field(type, pts, f, *pool);
+        else
+        {
+            ThreadPool serial(1);
+            field(type, pts, f, serial);
+        }
+
+        for(size_t i = 0; i < n; i++)
+            for(int k = 0; k < 3; k++)
+                out[3 * i + k] = f[i][k];
+        return;
+    }
+
+    for(size_t i = 0; i < n; i++)
+    {
+        vec3 f = field(type, vec3(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+        for(int k = 0; k < 3; k++)
+            out[3 * i + k] = f[k];
+    }
+}
+
+size_t Scene::update_basis(BasisField &bf, FieldType type,
+                           const std::function<vec3(size_t)> &point_at,
+                           ThreadPool &pool, Progress *progress) const
+{
+    int want = (type == FieldType::E) ? Entity::CHARGE : Entity::CURRENT;
+
+    /* drop deleted sources and re-weight the rest in one re-sum */
+    std::map<int, scalar> weights;
+    for(std::map<int, Entity>::const_iterator it = ents.begin(); it != ents.end(); it++)
+        if(it->second.type == want)
+            weights[it->first] = (type == FieldType::E) ? it->second.Q_density : it->second.I;
+    bf.set_weights(weights);
+
+    size_t n = bf.points();
+    size_t tiles = (n + TILE - 1) / TILE;
+    size_t computed = 0;
+
+    if(progress)
+    {
+        for(std::map<int, Entity>::const_iterator it = ents.begin(); it != ents.end(); it++)
+            if(it->second.type == want && !bf.has(it->first))
+                progress->add_total(n);
+    }
+
+    for(std::map<int, Entity>::const_iterator it = ents.begin(); it != ents.end(); it++)
+    {
+        const Entity &e = it->second;
+        if(e.type != want || bf.has(it->first))
+            continue;
+
+        std::vector<vec3> basis(n);
+
+        pool.parallel_for(tiles, [&](size_t tile) {
+                if(progress && progress->cancelled())
+                    return;
+
+                QuadratureStats stats;
+                size_t end = std::min(n, (tile + 1) * TILE);
+
+                TraceSpan span("field", "basis tile");
+                if(span.active())
+                    span.detail = "entity " + std::to_string(it->first) + ", points "
+                        + std::to_string(tile * TILE) + "-" + std::to_string(end);
+
+                for(size_t i = tile * TILE; i < end; i++)
+                    basis[i] = unit_field(type, e, point_at(i), stats);
+                add_stats(stats);
+
+                if(progress)
+                    progress->advance(end - tile * TILE);
+            });
+
+        if(progress && progress->cancelled())
+            break;
+
+        bf.add(it->first, type == FieldType::E ? e.Q_density : e.I, std::move(basis));
+        computed++;
+    }
+
+    return computed;
+}
+
+size_t Scene::sampled_field(FieldType type, vec3 x, scalar d, int gauss_order, vec3 &f) const
+{
+    size_t samples = 0;
+    f = 0;
+
+    for(std::map<int, Entity>::const_iterator i = ents.begin(); i != ents.end(); i++)
+    {
+        const Entity &e = i->second;
+        if(e.type != (type == FieldType::E ? Entity::CHARGE : Entity::CURRENT))
+            continue;
+
+        scalar k = (type == FieldType::E) ? K_E * e.Q_density : K_M * e.I;
+        Integrand in = (type == FieldType::E) ? COULOMB : BIOT_SAVART;
+
+        if(!d && e.shape.kind != Shape::NONE)
+        {
+            QuadratureStats stats;
+            Tolerance exact = { 1e-12, 0 };
+            f += adaptive_field(e.shape, in, x, exact, stats) * k;
+            samples += stats.evaluations;
+            continue;
+        }
+
+        /* without a Shape, the reference is the source's own samples */
+        SampleSet s;
+        if(!d)
+            s = e.samples;
+        else if(gauss_order && e.shape.kind != Shape::NONE)
+            gauss_samples(e.shape, gauss_order, d, s);
+        else
+            s.build(e.path.get(), d);
+
+        f += ((type == FieldType::E) ? coulomb(s, x) : biot_savart(s, x)) * k;
+        samples += s.size();
+    }
+
+    return samples;
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,225 @@
+#ifndef FIELDVIZ_SCENE_H
+#define FIELDVIZ_SCENE_H
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fml/fml.h>
+
+#include "basis.h"
+#include "fmm.h"
+#include "octree.h"
+#include "profile.h"
+#include "progress.h"
+#include "quadrature.h"
+#include "shape.h"
+#include "sources.h"
+#include "threadpool.h"
+
+namespace fieldviz {
+
+/* physical constants (SI) and the Coulomb and Biot-Savart prefactors */
+const fml::scalar U0 = 4e-7 * M_PI;
+const fml::scalar C = 299792458;
+const fml::scalar E0 = 1 / ( U0 * C * C );
+const fml::scalar K_E = 1 / (4 * M_PI * E0);
+const fml::scalar K_M = U0 / (4 * M_PI);
+
+enum class FieldType { E, B };
+
+/* A current or charge distribution */
+struct Entity {
+    /* can bitwise-OR together */
+    enum { CHARGE = 1 << 0, CURRENT = 1 << 1 } type;
+    union {
+        fml::scalar Q_density; /* linear charge density */
+        fml::scalar I; /* current */
+    };
+
+    /* shared with snapshots, freed with the last of them */
+    std::shared_ptr<fml::Manifold> path;
+
+    /* the parameters path was created with */
+    Shape shape;
+
+    /* path discretized at the current fineness */
+    SampleSet samples;
+
+    /* kernel evaluations and time spent on this source while
+     * profiling, under the direct solver */
+    std::shared_ptr<ProfileCounter> profile;
+};
+
+/* how the direct solver integrates sources without a closed form */
+enum Quadrature { QUAD_UNIFORM, QUAD_ADAPTIVE, QUAD_GAUSS };
+
+/* how fields are summed over the sources */
+enum Solver { SOLVER_DIRECT, SOLVER_TREE, SOLVER_FMM };
+
+const fml::scalar DEFAULT_D = 1e-1;
+
+/* Gauss-Legendre nodes per panel */
+const int DEFAULT_GAUSS_N = 4;
+const int MAX_GAUSS_N = 64;
+
+const Tolerance DEFAULT_TOL = { 1e-6, 0 };
+
+/* Barnes-Hut opening angle */
+const fml::scalar DEFAULT_THETA = .5;
+
+/* FMM expansion order */
+const int DEFAULT_ORDER = 6;
+const int MAX_ORDER = 12;
+
+/* A set of sources and the settings their fields are evaluated with.
+ *
+ * Queries (the const member functions) may run concurrently from any
+ * number of threads; the solver's source structures are built by the
+ * first query after a change.  Changes must not overlap with queries.
+ * The field kernels (set_kernel_isa() in kernels.h) are not a setting
+ * of the scene but of the process, so changing them must not overlap
+ * with queries on any scene. */
+class Scene {
+public:
+    Scene() {}
+
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+
+    /* sources; return the new entity's ID.  The scene keeps path
+     * alive for as long as it (or a snapshot) has the entity. */
+    int add_current(fml::scalar I, std::shared_ptr<fml::Manifold> path, const Shape &shape);
+    int add_charge(fml::scalar Q_density, std::shared_ptr<fml::Manifold> path, const Shape &shape);
+
+    /* returns false if there is no such entity */
+    bool remove(int id);
+    bool set_strength(int id, fml::scalar value);
+
+    const std::map<int, Entity> &entities() const { return ents; }
+
+    /* A copy of the sources and settings, which can be queried from
+     * other threads while this scene goes on changing.  It shares the
+     * sources' paths and profile counters. */
+    std::shared_ptr<const Scene> snapshot() const;
+
+    /* settings */
+    fml::scalar delta() const { return D; }
+    void set_delta(fml::scalar d);
+
+    Quadrature quadrature() const { return quad; }
+    int gauss_order() const { return gauss_n; }
+    const Tolerance &tolerance() const { return tol; }
+    void set_quadrature(Quadrature q, int gauss_n = DEFAULT_GAUSS_N);
+    void set_tolerance(const Tolerance &t);
+
+    /* use closed forms for the sources that have them */
+    bool analytic() const { return use_analytic; }
+    void set_analytic(bool on) { use_analytic = on; }
+
+    Solver solver() const { return solv; }
+    void set_solver(Solver s);
+
+    fml::scalar theta() const { return opening; }
+    void set_theta(fml::scalar t) { opening = t; }
+
+    int fmm_order() const { return order; }
+    void set_fmm_order(int p);
+
+    /* Field at one point.  The FMM only pays off for many points at
+     * once, so under it these use the direct sum. */
+    fml::vec3 field(FieldType type, fml::vec3 x) const;
+    fml::vec3 Bfield(fml::vec3 x) const { return field(FieldType::B, x); }
+    fml::vec3 Efield(fml::vec3 x) const { return field(FieldType::E, x); }
+
+    /* field at x summed over every source, whatever the solver */
+    fml::vec3 direct_field(FieldType type, fml::vec3 x) const;
+
+    /* Field at many points, split across pool.  Points done count
+     * towards progress, if given; once it is cancelled the rest of out
+     * is left unset. */
+    void field(FieldType type, const std::vector<fml::vec3> &pts,
+               std::vector<fml::vec3> &out, ThreadPool &pool,
+               Progress *progress = NULL) const;
+
+    /* Field at n points given as xyz triples, written to out as n
+     * triples.  Runs on the calling thread only (unless a pool is
+     * given), so callers can evaluate from as many threads as they
+     * like. */
+    void evaluate(FieldType type, const double *xyz, size_t n, double *out,
+                  ThreadPool *pool = NULL) const;
+    void evaluate_B(const double *xyz, size_t n, double *out) const { evaluate(FieldType::B, xyz, n, out); }
+    void evaluate_E(const double *xyz, size_t n, double *out) const { evaluate(FieldType::E, xyz, n, out); }
+
+    /* field of one source at unit strength, exactly where possible */
+    fml::vec3 unit_field(FieldType type, const Entity &e, fml::vec3 x, QuadratureStats &stats) const;
+
+    /* Bring bf up to date with the sources of the given type: drop the
+     * deleted ones, re-weight any whose strength changed, and evaluate
+     * the basis of new ones at point_at(0..n-1) across pool.  Returns
+     * the number of sources evaluated.  If progress is cancelled, the
+     * source being evaluated is not added and the rest are skipped, so
+     * bf holds a smaller but complete set. */
+    size_t update_basis(BasisField &bf, FieldType type,
+                        const std::function<fml::vec3(size_t)> &point_at,
+                        ThreadPool &pool, Progress *progress = NULL) const;
+
+    /* field at x from every source of the given type, discretized
+     * afresh at fineness d (gauss_order 0 = libfml's uniform steps), or
+     * to 1e-12 by adaptive quadrature if d is 0 (taking the samples
+     * as they are for sources without a Shape); returns the number of
+     * samples */
+    size_t sampled_field(FieldType type, fml::vec3 x, fml::scalar d, int gauss_order, fml::vec3 &f) const;
+
+    /* build the solver's source structures now rather than on the
+     * first query */
+    void prepare() const;
+
+    /* adaptive quadrature work since the last reset */
+    void reset_stats() const;
+    size_t quad_evaluations() const { return quad_evals; }
+    size_t quad_unconverged() const { return quad_failed; }
+
+    /* Work done while profiling: per source in each Entity, and by the
+     * tree and FMM solvers (which cannot tell sources apart) here, with
+     * points as the units. */
+    const ProfileCounter &solver_profile() const { return solver_prof; }
+    void reset_profile() const;
+
+private:
+    int ent_counter = 0;
+    std::map<int, Entity> ents;
+
+    fml::scalar D = DEFAULT_D;
+    Quadrature quad = QUAD_UNIFORM;
+    int gauss_n = DEFAULT_GAUSS_N;
+    Tolerance tol = DEFAULT_TOL;
+    bool use_analytic = true;
+    Solver solv = SOLVER_DIRECT;
+    fml::scalar opening = DEFAULT_THETA;
+    int order = DEFAULT_ORDER;
+
+    /* built lazily by prepare() */
+    mutable std::mutex prepare_mtx;
+    mutable std::atomic<bool> trees_stale{true};
+    mutable Octree current_tree{Octree::CURRENT}, charge_tree{Octree::CHARGE};
+    mutable FMM current_fmm{FMM::CURRENT}, charge_fmm{FMM::CHARGE};
+
+    mutable std::atomic<size_t> quad_evals{0}, quad_failed{0};
+    mutable ProfileCounter solver_prof;
+
+    int add_entity(Entity e);
+    void build_samples(Entity &e);
+    void rebuild_samples();
+    void add_stats(const QuadratureStats &stats) const;
+    fml::vec3 integrate(FieldType type, const Entity &e, fml::vec3 x, QuadratureStats &stats) const;
+};
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,328 @@
+#include "shape.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <string>
+
+using namespace fml;
+
+namespace fieldviz {
+
+void Shape::orient(const SampleSet &s)
+{
+    scalar dir = 0;
+
+    for(size_t i = 0; i < s.size(); i++)
+    {
+        if(kind == LINE)
+            dir += s.element(i).dot(b - a);
+        else if(kind == ARC || kind == SPIRAL || kind == TOROID)
+            dir += normal.dot((s.position(i) - center).cross(s.element(i)));
+    }
+
+    sense = (dir < 0) ? -1 : 1;
+}
+
+/* panels of at most a quarter turn over an angle */
+static int quarter_turns(scalar angle)
+{
+    return std::max(1, (int)std::ceil(std::fabs(angle) / (M_PI / 2)));
+}
+
+void Shape::patches(std::vector<Patch> &out) const
+{
+    Patch p;
+    p.shape = this;
+    p.part = 0;
+    p.dim = 1;
+    p.u1 = 1;
+    p.v1 = 0;
+    p.nu = 1;
+    p.nv = 1;
+
+    switch(kind)
+    {
+    case LINE:
+        out.push_back(p);
+        break;
+    case ARC:
+    case SPIRAL:
+        p.u1 = angle;
+        p.nu = quarter_turns(angle);
+        out.push_back(p);
+        break;
+    case TOROID:
+        /* one poloidal turn per `pitch' of major angle */
+        p.u1 = angle;
+        p.nu = quarter_turns(2 * M_PI * angle / pitch);
+        out.push_back(p);
+        break;
+    case PLANE:
+        p.dim = 2;
+        p.v1 = 1;
+        out.push_back(p);
+        break;
+    case DISK:
+        p.dim = 2;
+        p.u1 = radius.magnitude();
+        p.v1 = angle;
+        p.nv = quarter_turns(angle);
+        out.push_back(p);
+        break;
+    case SPHERE:
+        p.dim = 2;
+        p.u1 = M_PI;
+        p.v1 = 2 * M_PI;
+        p.nu = 2;
+        p.nv = 4;
+        out.push_back(p);
+        break;
+    case CLOSEDCYLINDER:
+        /* the two caps, then the side */
+        for(int cap = 1; cap <= 2; cap++)
+        {
+            Patch c = p;
+            c.part = cap;
+            c.dim = 2;
+            c.u1 = minor;
+            c.v1 = 2 * M_PI;
+            c.nv = 4;
+            out.push_back(c);
+        }
+        /* fall through */
+    case OPENCYLINDER:
+        p.dim = 2;
+        p.u1 = a.magnitude();
+        p.v1 = 2 * M_PI;
+        p.nv = 4;
+        out.push_back(p);
+        break;
+    default:
+        break;
+    }
+}
+
+/* unit vectors spanning the plane normal to n */
+static void plane_basis(vec3 n, vec3 &e, vec3 &f)
+{
+    e = (std::fabs(n[0]) < .9 ? vec3(1, 0, 0) : vec3(0, 1, 0)).cross(n).normalize();
+    f = n.cross(e);
+}
+
+void Patch::at(scalar u, scalar v, vec3 &s, vec3 &ds) const
+{
+    const Shape &sh = *shape;
+
+    switch(sh.kind)
+    {
+    case Shape::LINE:
+        s = sh.a + (sh.b - sh.a) * u;
+        ds = (sh.b - sh.a) * sh.sense;
+        break;
+    case Shape::ARC:
+    case Shape::SPIRAL:
+    {
+        /* center + radius cos u + (normal x radius) sin u, rising by
+         * pitch per turn for spirals */
+        vec3 n = sh.normal.normalize();
+        vec3 w = n.cross(sh.radius);
+        scalar rise = sh.pitch / (2 * M_PI);
+
+        s = sh.center + sh.radius * std::cos(u) + w * std::sin(u) + n * (rise * u);
+        ds = (w * std::cos(u) - sh.radius * std::sin(u) + n * rise) * sh.sense;
+        break;
+    }
+    case Shape::TOROID:
+    {
+        /* major angle u; the winding goes once around the minor circle
+         * for every `pitch' of major angle */
+        vec3 n = sh.normal.normalize();
+        scalar R = sh.radius.magnitude();
+        vec3 w = n.cross(sh.radius);
+
+        vec3 rhat = (sh.radius * std::cos(u) + w * std::sin(u)) / R;
+        vec3 drhat = (w * std::cos(u) - sh.radius * std::sin(u)) / R;
+
+        scalar k = 2 * M_PI / sh.pitch, phi = k * u;
+        scalar m = sh.minor;
+
+        s = sh.center + rhat * (R + m * std::cos(phi)) + n * (m * std::sin(phi));
+        ds = (drhat * (R + m * std::cos(phi)) - rhat * (m * k * std::sin(phi)) + n * (m * k * std::cos(phi))) * sh.sense;
+        break;
+    }
+    case Shape::PLANE:
+        s = sh.center + sh.a * u + sh.b * v;
+        ds = sh.a.cross(sh.b);
+        break;
+    case Shape::DISK:
+    {
+        /* radius u, angle v */
+        vec3 n = sh.normal.normalize();
+        scalar R = sh.radius.magnitude();
+        vec3 w = n.cross(sh.radius);
+
+        s = sh.center + (sh.radius * std::cos(v) + w * std::sin(v)) * (u / R);
+        ds = n * u;
+        break;
+    }
+    case Shape::SPHERE:
+    {
+        /* polar angle u, azimuth v */
+        vec3 rhat(std::sin(u) * std::cos(v), std::sin(u) * std::sin(v), std::cos(u));
+        scalar R = sh.minor;
+
+        s = sh.center + rhat * R;
+        ds = rhat * (R * R * std::sin(u));
+        break;
+    }
+    case Shape::OPENCYLINDER:
+    case Shape::CLOSEDCYLINDER:
+    {
+        vec3 n = sh.a.normalize(), e, f;
+        plane_basis(n, e, f);
+
+        vec3 radial = e * std::cos(v) + f * std::sin(v);
+
+        if(part == 0)
+        {
+            /* side: height u, angle v */
+            s = sh.center + n * u + radial * sh.minor;
+            ds = radial * sh.minor;
+        }
+        else
+        {
+            /* caps: radius u, angle v; outward normals */
+            s = sh.center + (part == 2 ? sh.a : vec3(0)) + radial * u;
+            ds = n * (part == 2 ? u : -u);
+        }
+        break;
+    }
+    default:
+        s = 0;
+        ds = 0;
+        break;
+    }
+}
+
+std::shared_ptr<Manifold> parse_curve(std::istream &ss, Shape &shape)
+{
+    std::string type;
+    ss >> type;
+    if(type == "line" || type == "linesegment")
+    {
+        vec3 a, b;
+        ss >> a >> b;
+
+        shape.kind = Shape::LINE;
+        shape.a = a;
+        shape.b = b;
+        return std::make_shared<LineSegment>(a, b);
+    }
+    else if(type == "arc")
+    {
+        vec3 center, radius, normal;
+        scalar angle;
+        ss >> center >> radius >> normal;
+        ss >> angle;
+
+        shape.kind = Shape::ARC;
+        shape.center = center;
+        shape.radius = radius;
+        shape.normal = normal;
+        shape.angle = angle;
+        return std::make_shared<Arc>(center, radius, normal, angle);
+    }
+    else if(type == "spiral" || type == "solenoid")
+    {
+        vec3 origin, radius, normal;
+        scalar angle, pitch;
+        ss >> origin >> radius >> normal >> angle >> pitch;
+
+        shape.kind = Shape::SPIRAL;
+        shape.center = origin;
+        shape.radius = radius;
+        shape.normal = normal;
+        shape.angle = angle;
+        shape.pitch = pitch;
+        return std::make_shared<Spiral>(origin, radius, normal, angle, pitch);
+    }
+    else if(type == "toroid")
+    {
+        vec3 origin, maj_radius, maj_normal;
+        scalar min_radius, maj_angle, pitch;
+        ss >> origin >> maj_radius >> maj_normal;
+        ss >> min_radius >> maj_angle >> pitch;
+
+        shape.kind = Shape::TOROID;
+        shape.center = origin;
+        shape.radius = maj_radius;
+        shape.normal = maj_normal;
+        shape.minor = min_radius;
+        shape.angle = maj_angle;
+        shape.pitch = pitch;
+        return std::make_shared<Toroid>(origin, maj_radius, maj_normal, maj_angle, min_radius, pitch);
+    }
+    else if(type == "plane")
+    {
+        vec3 origin, v1, v2;
+        ss >> origin >> v1 >> v2;
+
+        shape.kind = Shape::PLANE;
+        shape.center = origin;
+        shape.a = v1;
+        shape.b = v2;
+        return std::make_shared<Plane>(origin, v1, v2);
+    }
+    else if(type == "disk")
+    {
+        vec3 center, radius, normal;
+        scalar angle;
+        ss >> center >> radius >> normal >> angle;
+
+        shape.kind = Shape::DISK;
+        shape.center = center;
+        shape.radius = radius;
+        shape.normal = normal;
+        shape.angle = angle;
+        return std::make_shared<Disk>(center, radius, normal, angle);
+    }
+    else if(type == "sphere")
+    {
+        vec3 center;
+        scalar radius;
+        ss >> center >> radius;
+
+        shape.kind = Shape::SPHERE;
+        shape.center = center;
+        shape.minor = radius;
+        return std::make_shared<Sphere>(center, radius);
+    }
+    else if(type == "opencylinder")
+    {
+        vec3 origin, axis;
+        scalar rad;
+        ss >> origin >> axis >> rad;
+
+        shape.kind = Shape::OPENCYLINDER;
+        shape.center = origin;
+        shape.a = axis;
+        shape.minor = rad;
+        return std::make_shared<OpenCylinder>(origin, axis, rad);
+    }
+    else if(type == "closedcylinder")
+    {
+        vec3 origin, axis;
+        scalar rad;
+        ss >> origin >> axis >> rad;
+
+        shape.kind = Shape::CLOSEDCYLINDER;
+        shape.center = origin;
+        shape.a = axis;
+        shape.minor = rad;
+        return std::make_shared<ClosedCylinder>(origin, axis, rad);
+    }
+    else throw "unknown curve type (must be line, arc, spiral, or toroid)";
+}
+
+} /* namespace fieldviz */
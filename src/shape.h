@@ -0,0 +1,72 @@
+#ifndef FIELDVIZ_SHAPE_H
+#define FIELDVIZ_SHAPE_H
+
+#include <istream>
+#include <memory>
+#include <vector>
+
+#include <fml/fml.h>
+
+#include "sources.h"
+
+namespace fieldviz {
+
+struct Patch;
+
+/* The parameters a manifold was created from.  libfml only exposes a
+ * manifold through its samples; solvers that need the exact geometry
+ * (closed forms, custom quadrature) use these instead. */
+struct Shape {
+    enum Kind { NONE, LINE, ARC, SPIRAL, TOROID, PLANE, DISK, SPHERE, OPENCYLINDER, CLOSEDCYLINDER };
+    Kind kind = NONE;
+
+    /* LINE:                a -> b
+     * ARC, SPIRAL, DISK:   center, radius, normal, angle (+ pitch)
+     * TOROID:              center, radius, normal, angle, minor, pitch
+     * PLANE:               center + s a + t b
+     * SPHERE:              center, minor
+     * *CYLINDER:           center, a (axis), minor */
+    fml::vec3 center = 0, radius = 0, normal = 0, a = 0, b = 0;
+    fml::scalar angle = 0, pitch = 0, minor = 0;
+
+    /* +1 if libfml traverses a LINE from a to b, or an ARC, SPIRAL or
+     * TOROID counterclockwise about its normal; -1 otherwise */
+    fml::scalar sense = 1;
+
+    /* set sense from how the manifold was actually sampled */
+    void orient(const SampleSet &s);
+
+    /* the smooth pieces of the shape's parameter domain */
+    void patches(std::vector<Patch> &out) const;
+};
+
+/* Read a manifold description such as "line <a> <b>" (the MANIFOLD
+ * part of `add'), returning the new manifold and filling in shape.
+ * Throws a message if the type is unknown. */
+std::shared_ptr<fml::Manifold> parse_curve(std::istream &in, Shape &shape);
+
+/* One smooth, rectangular piece of a shape's parameter domain,
+ * [0, u1] for curves or [0, u1] x [0, v1] for surfaces.  These follow
+ * the documented meaning of each shape's parameters. */
+struct Patch {
+    const Shape *shape;
+
+    /* which piece, for shapes made of several */
+    int part;
+
+    /* 1 for curves, 2 for surfaces */
+    int dim;
+
+    fml::scalar u1, v1;
+
+    /* panels to start adaptive or fixed-order quadrature with, so that
+     * no panel spans more than about a quarter turn */
+    int nu, nv;
+
+    /* position s and ds (curves) or dA (surfaces) per unit parameter */
+    void at(fml::scalar u, fml::scalar v, fml::vec3 &s, fml::vec3 &ds) const;
+};
+
+} /* namespace fieldviz */
+
+#endif
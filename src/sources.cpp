@@ -0,0 +1,55 @@
+#include "sources.h"
+
+#include "integrate.h"
+
+using namespace fml;
+
+namespace fieldviz {
+
+namespace {
+
+struct Collector {
+    SampleSet &set;
+
+    Collector(SampleSet &set) : set(set) {}
+
+    void operator()(vec3 s, vec3 ds)
+    {
+        set.push_back(s, ds);
+    }
+};
+
+}
+
+void SampleSet::push_back(vec3 s, vec3 ds)
+{
+    x.push_back(s[0]);
+    y.push_back(s[1]);
+    z.push_back(s[2]);
+
+    dx.push_back(ds[0]);
+    dy.push_back(ds[1]);
+    dz.push_back(ds[2]);
+
+    w.push_back(ds.magnitude());
+}
+
+void SampleSet::build(Manifold *m, scalar d)
+{
+    *this = SampleSet();
+    delta = d;
+
+    Collector c(*this);
+    for_each_sample(m, d, c);
+
+    /* drop the slack left over from growing the arrays */
+    x.shrink_to_fit();
+    y.shrink_to_fit();
+    z.shrink_to_fit();
+    dx.shrink_to_fit();
+    dy.shrink_to_fit();
+    dz.shrink_to_fit();
+    w.shrink_to_fit();
+}
+
+} /* namespace fieldviz */
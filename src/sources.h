@@ -0,0 +1,50 @@
+#ifndef FIELDVIZ_SOURCES_H
+#define FIELDVIZ_SOURCES_H
+
+#include <cstddef>
+#include <vector>
+
+#include <fml/fml.h>
+
+namespace fieldviz {
+
+/* A manifold flattened into its integration samples at a fixed
+ * fineness, stored as structure-of-arrays so the field kernels can
+ * stream through them without going back through Manifold. */
+struct SampleSet {
+    fml::scalar delta = 0;
+
+    /* Gauss-Legendre nodes per panel, or 0 for libfml's uniform steps */
+    int gauss_order = 0;
+
+    /* positions */
+    std::vector<fml::scalar> x, y, z;
+
+    /* ds vectors */
+    std::vector<fml::scalar> dx, dy, dz;
+
+    /* |ds| */
+    std::vector<fml::scalar> w;
+
+    size_t size() const { return x.size(); }
+
+    /* resample m at fineness delta */
+    void build(fml::Manifold *m, fml::scalar delta);
+
+    void push_back(fml::vec3 s, fml::vec3 ds);
+
+    fml::vec3 position(size_t i) const { return fml::vec3(x[i], y[i], z[i]); }
+    fml::vec3 element(size_t i) const { return fml::vec3(dx[i], dy[i], dz[i]); }
+
+    /* call f(s, ds, |ds|) for every sample, in generation order */
+    template<typename F>
+    void for_each(F &f) const
+    {
+        for(size_t i = 0; i < size(); i++)
+            f(position(i), element(i), w[i]);
+    }
+};
+
+} /* namespace fieldviz */
+
+#endif
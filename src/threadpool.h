@@ -0,0 +1,156 @@
+#ifndef FIELDVIZ_THREADPOOL_H
+#define FIELDVIZ_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fieldviz {
+
+/* A fixed set of worker threads that cooperatively run a loop over
+ * [0, n).  Indices are handed out dynamically, so uneven work (points
+ * near a source are no more expensive than far ones today, but tiles
+ * at the edge of a grid are smaller) still balances. */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned n_threads)
+    {
+        if(!n_threads)
+            n_threads = 1;
+
+        /* the calling thread participates, so spawn one fewer */
+        for(unsigned i = 1; i < n_threads; i++)
+            workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for(std::thread &t : workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned size() const { return workers.size() + 1; }
+
+    /* Call fn(i) for every i in [0, n), returning once all are done.
+     * Concurrent callers take turns, so fn must not itself call
+     * parallel_for on the same pool.  If fn throws, no more indices are
+     * handed out, and the first exception is rethrown here once every
+     * thread has left fn. */
+    void parallel_for(size_t n, const std::function<void(size_t)> &fn)
+    {
+        if(!n)
+            return;
+
+        std::lock_guard<std::mutex> turn(caller_mtx);
+
+        if(workers.empty() || n == 1)
+        {
+            for(size_t i = 0; i < n; i++)
+                fn(i);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+
+        job = &fn;
+        job_size = n;
+        job_error = nullptr;
+        next_index = 0;
+        active = workers.size();
+        generation++;
+
+        lock.unlock();
+        wake.notify_all();
+
+        run_job(fn, n);
+
+        lock.lock();
+        done.wait(lock, [this] { return active == 0; });
+        job = nullptr;
+
+        std::exception_ptr error = job_error;
+        job_error = nullptr;
+        lock.unlock();
+
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    std::vector<std::thread> workers;
+
+    /* held by the caller of parallel_for for its whole run */
+    std::mutex caller_mtx;
+
+    std::mutex mtx;
+    std::condition_variable wake, done;
+
+    const std::function<void(size_t)> *job = nullptr;
+    size_t job_size = 0;
+    std::exception_ptr job_error;
+    std::atomic<size_t> next_index{0};
+    unsigned active = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+
+    void run_job(const std::function<void(size_t)> &fn, size_t n)
+    {
+        try {
+            size_t i;
+            while((i = next_index.fetch_add(1)) < n)
+                fn(i);
+        } catch(...) {
+            /* let the other threads run out of work */
+            next_index = n;
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if(!job_error)
+                job_error = std::current_exception();
+        }
+    }
+
+    void worker_loop()
+    {
+        unsigned long seen = 0;
+
+        while(1)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+
+            if(stopping)
+                return;
+
+            seen = generation;
+
+            const std::function<void(size_t)> &fn = *job;
+            size_t n = job_size;
+
+            lock.unlock();
+
+            run_job(fn, n);
+
+            lock.lock();
+            if(--active == 0)
+                done.notify_one();
+        }
+    }
+};
+
+} /* namespace fieldviz */
+
+#endif
@@ -0,0 +1,125 @@
+#include "trace.h"
+
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace fieldviz {
+
+std::atomic<bool> trace_enabled{false};
+
+namespace {
+
+struct Span {
+    const char *cat, *name;
+    uint64_t start, end;
+    int tid;
+    std::string detail;
+};
+
+std::mutex trace_mtx;
+std::vector<Span> spans;
+uint64_t trace_origin;
+
+/* threads are numbered in the order they first record a span */
+std::atomic<int> next_tid{0};
+thread_local int tid = -1;
+int main_tid = -1;
+
+int thread_id()
+{
+    if(tid < 0)
+        tid = next_tid++;
+    return tid;
+}
+
+void write_string(std::ostream &out, const std::string &s)
+{
+    out << '"';
+    for(char c : s)
+    {
+        if(c == '"' || c == '\\')
+            out << '\\' << c;
+        else if((unsigned char)c < 0x20)
+            out << ' ';
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+}
+
+void trace_start()
+{
+    std::lock_guard<std::mutex> lock(trace_mtx);
+
+    spans.clear();
+    trace_origin = profile_clock();
+    main_tid = thread_id();
+    trace_enabled = true;
+}
+
+void trace_record(const char *cat, const char *name, uint64_t start, uint64_t end,
+                  const std::string &detail)
+{
+    int t = thread_id();
+
+    std::lock_guard<std::mutex> lock(trace_mtx);
+
+    /* a span that started before this trace, or ended after it */
+    if(!tracing() || start < trace_origin)
+        return;
+
+    spans.push_back(Span{ cat, name, start, end, t, detail });
+}
+
+long trace_stop(const std::string &path)
+{
+    trace_enabled = false;
+
+    std::lock_guard<std::mutex> lock(trace_mtx);
+
+    std::ofstream out(path);
+    if(!out)
+        return -1;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+
+    /* name the threads */
+    for(int t = 0; t < next_tid; t++)
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+            << ",\"args\":{\"name\":\"" << (t == main_tid ? "main" : "worker") << " " << t << "\"}}"
+            << (t + 1 < next_tid || !spans.empty() ? "," : "") << std::endl;
+
+    out.precision(3);
+    out << std::fixed;
+
+    for(size_t i = 0; i < spans.size(); i++)
+    {
+        const Span &s = spans[i];
+
+        out << "{\"name\":\"" << s.name << "\",\"cat\":\"" << s.cat << "\",\"ph\":\"X\""
+            << ",\"ts\":" << (s.start - trace_origin) / 1e3
+            << ",\"dur\":" << (s.end - s.start) / 1e3
+            << ",\"pid\":1,\"tid\":" << s.tid;
+
+        if(!s.detail.empty())
+        {
+            out << ",\"args\":{\"detail\":";
+            write_string(out, s.detail);
+            out << "}";
+        }
+
+        out << "}" << (i + 1 < spans.size() ? "," : "") << std::endl;
+    }
+
+    out << "]}" << std::endl;
+
+    long n = spans.size();
+    spans.clear();
+
+    return out ? n : -1;
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,69 @@
+#ifndef FIELDVIZ_TRACE_H
+#define FIELDVIZ_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "profile.h"
+
+namespace fieldviz {
+
+/* A timeline of spans of work, each on the thread that did it, saved
+ * in the Chrome trace-event format that chrome://tracing and Perfetto
+ * load.  While no trace is being recorded, each span costs one relaxed
+ * load and a branch. */
+
+extern std::atomic<bool> trace_enabled;
+
+inline bool tracing()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+/* start recording, dropping anything recorded before */
+void trace_start();
+
+/* Stop recording and write what was recorded to path as JSON.  Returns
+ * the number of spans written, or -1 if the file could not be
+ * written. */
+long trace_stop(const std::string &path);
+
+/* one span from start to end (profile_clock() times); cat and name
+ * must be string constants */
+void trace_record(const char *cat, const char *name, uint64_t start, uint64_t end,
+                  const std::string &detail);
+
+/* records the time until it goes out of scope as a span, if a trace
+ * was being recorded when it was created */
+class TraceSpan {
+public:
+    TraceSpan(const char *cat, const char *name) : cat(cat), name(name), on(tracing())
+    {
+        if(on)
+            start = profile_clock();
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    ~TraceSpan()
+    {
+        if(on)
+            trace_record(cat, name, start, profile_clock(), detail);
+    }
+
+    bool active() const { return on; }
+
+    /* shown with the span; only worth filling in if active() */
+    std::string detail;
+
+private:
+    const char *cat, *name;
+    bool on;
+    uint64_t start = 0;
+};
+
+} /* namespace fieldviz */
+
+#endif
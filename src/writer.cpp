@@ -0,0 +1,84 @@
+#include "writer.h"
+
+#include <charconv>
+#include <cstring>
+
+using namespace fml;
+
+namespace fieldviz {
+
+/* ostream's default precision */
+static const int PRECISION = 6;
+
+/* longest %.6g: sign, 6 digits, point, and "e-308" */
+static const size_t MAX_SCALAR_CHARS = 32;
+
+BufferedWriter::BufferedWriter(std::ostream &out) : out(out), buf(BUFFER_SIZE)
+{
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    flush();
+}
+
+void BufferedWriter::flush()
+{
+    out.write(buf.data(), used);
+    written += used;
+    used = 0;
+}
+
+void TextWriter::put(scalar x)
+{
+    reserve(MAX_SCALAR_CHARS);
+
+    char *begin = buf.data() + used;
+    std::to_chars_result r = std::to_chars(begin, begin + MAX_SCALAR_CHARS, x,
+                                           std::chars_format::general, PRECISION);
+    used += r.ptr - begin;
+}
+
+void TextWriter::put(vec3 v)
+{
+    put(v[0]);
+    put(' ');
+    put(v[1]);
+    put(' ');
+    put(v[2]);
+}
+
+void BinaryWriter::put(scalar x)
+{
+    reserve(sizeof(double));
+
+    if(format == FLOAT32)
+    {
+        float f = x;
+        memcpy(buf.data() + used, &f, sizeof(f));
+        used += sizeof(f);
+    }
+    else
+    {
+        double d = x;
+        memcpy(buf.data() + used, &d, sizeof(d));
+        used += sizeof(d);
+    }
+}
+
+void BinaryWriter::put(vec3 v)
+{
+    put(v[0]);
+    put(v[1]);
+    put(v[2]);
+}
+
+std::string gnuplot_binary_spec(BinaryFormat format, size_t n, int columns)
+{
+    std::string spec = "binary record=" + std::to_string(n) + " format='";
+    for(int i = 0; i < columns; i++)
+        spec += (format == FLOAT32) ? "%float32" : "%float64";
+    return spec + "'";
+}
+
+} /* namespace fieldviz */
@@ -0,0 +1,102 @@
+#ifndef FIELDVIZ_WRITER_H
+#define FIELDVIZ_WRITER_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fml/fml.h>
+
+namespace fieldviz {
+
+/* Collects output in a large buffer and hands it to the stream in big
+ * blocks, instead of per value. */
+class BufferedWriter {
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    explicit BufferedWriter(std::ostream &out);
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter &) = delete;
+    BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+    /* write out everything buffered so far */
+    void flush();
+
+    /* bytes written so far, buffered or not */
+    size_t bytes() const { return written + used; }
+
+protected:
+    std::ostream &out;
+    std::vector<char> buf;
+    size_t used = 0, written = 0;
+
+    void reserve(size_t n)
+    {
+        if(used + n > buf.size())
+            flush();
+    }
+};
+
+/* Formats numbers straight into the buffer with std::to_chars, instead
+ * of going through operator<< and flushing with endl on every line.
+ * The text is the same as a default-formatted ostream would produce
+ * (%g with six significant digits), so gnuplot reads it exactly as
+ * before. */
+class TextWriter : public BufferedWriter {
+public:
+    explicit TextWriter(std::ostream &out) : BufferedWriter(out) {}
+
+    void put(fml::scalar x);
+
+    /* "x y z", as operator<< writes a vec3 */
+    void put(fml::vec3 v);
+
+    void put(char c)
+    {
+        reserve(1);
+        buf[used++] = c;
+    }
+
+    void newline() { put('\n'); }
+
+    /* a point and a vector on one line */
+    void line(fml::vec3 a, fml::vec3 b)
+    {
+        put(a);
+        put(' ');
+        put(b);
+        newline();
+    }
+};
+
+enum BinaryFormat { FLOAT32, FLOAT64 };
+
+/* Raw native-endian records of floats or doubles, which gnuplot reads
+ * without any parsing. */
+class BinaryWriter : public BufferedWriter {
+public:
+    BinaryWriter(std::ostream &out, BinaryFormat format) : BufferedWriter(out), format(format) {}
+
+    void put(fml::scalar x);
+    void put(fml::vec3 v);
+
+    /* one record: a point and a vector */
+    void line(fml::vec3 a, fml::vec3 b)
+    {
+        put(a);
+        put(b);
+    }
+
+private:
+    BinaryFormat format;
+};
+
+/* the gnuplot data file modifiers for n records of `columns' values */
+std::string gnuplot_binary_spec(BinaryFormat format, size_t n, int columns);
+
+} /* namespace fieldviz */
+
+#endif